@@ -2,7 +2,16 @@
 #include <ctype.h>
 #include <string.h>
 #include <stdlib.h>
-#include "avl.h"
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD
+#endif
 
 #define ALLOC(x, n) (x = malloc((n) * sizeof(*(x))))
 #define STATIC_ARRLEN(array) (sizeof(array)/sizeof(array[0]))
@@ -13,35 +22,45 @@
  * the word we are matching passwords with
  */
 #define WORDMATCH_CRITERION 0.8
+// Bytes of passwords handed to a worker thread at a time
+#define CHUNK_SIZE (1 << 22)
+// Initial size of the buffer lines of a mapped file are copied into
+#define LINE_BUFFER_SIZE 1024
+// Chunks in flight per worker thread, which bounds the memory used for input
+#define CHUNKS_PER_WORKER 2
+// Bytes per arena block holding the keys of a count map
+#define ARENA_BLOCK_SIZE (1 << 20)
+// Slots of a new count map, a power of two
+#define COUNT_MAP_INITIAL_SLOTS 1024
+// Prefixes this long or longer are not counted
+#define PREFIX_MAX_LEN 1024
+// Longest q-gram the wordlist index is keyed on, at most 4
+#define INDEX_MAX_Q 4
+// Longest strings the vectorized best_match kernels copy into their buffers
+#define MATCH_MAX_LEN 1024
+// Bytes past the end of a string a vector load may touch
+#define MATCH_PADDING 32
 
 
-struct table_entry {
-	char character;
-	unsigned long long frequency;
-};
-
-struct table_row {
-	int n_entries;
-	struct table_entry entries[256];
-};
-
+/*
+ * Replacement counts indexed by original and replacement character. A row is
+ * written in the order its replacements were first seen in.
+ */
 struct table {
-	struct table_row rows[256];
+	uint64_t counts[256][256];
+	// Sequence number of the table when the count became nonzero
+	uint64_t first_seen[256][256];
+	uint64_t sequence;
 };
 
 
 static struct table *table_create_empty(void)
 {
 	ENTER_FUNCTION_CB();
-	int i;
 	struct table *table;
 
-	if (!ALLOC(table, 1))
+	if (!(table = calloc(1, sizeof *table)))
 		goto oom;
-	for (i=0x00; i<=0xFF; i++)
-		// Number of entries is dynamic, default to 0
-		table->rows[i].n_entries = 0;
-
 	return table;
  oom:
 	fprintf(stderr, "%s: Out of memory...\n", __func__);
@@ -49,39 +68,72 @@ static struct table *table_create_empty(void)
 }
 
 
-static void table_new_add_cb(struct table *table, unsigned char original,
-			     unsigned char replacement, int frequency)
+static inline void table_new_add_cb(struct table *table,
+				    unsigned char original,
+				    unsigned char replacement,
+				    uint64_t frequency)
 {
 	ENTER_FUNCTION_CB();
-	int i;
-	struct table_row *row = &table->rows[original];
-	for (i=0; i<row->n_entries; i++)
-		if (row->entries[i].character == replacement) {
-			row->entries[i].frequency += frequency;
-			return;
+	if (!table->counts[original][replacement])
+		table->first_seen[original][replacement] = table->sequence++;
+	table->counts[original][replacement] += frequency;
+}
+
+
+/*
+ * Adds the counts of src to table. Replacements counted in both keep the
+ * earlier of their first_seen numbers.
+ */
+static void table_merge(struct table *table, struct table *src)
+{
+	ENTER_FUNCTION_CB();
+	int i, j;
+	for (i=0x00; i<=0xFF; i++)
+		for (j=0x00; j<=0xFF; j++) {
+			if (!src->counts[i][j])
+				continue;
+			if (!table->counts[i][j] ||
+			    src->first_seen[i][j] < table->first_seen[i][j])
+				table->first_seen[i][j] = src->first_seen[i][j];
+			table->counts[i][j] += src->counts[i][j];
 		}
-	// Replacement character was not in the row at this point
-	row->entries[row->n_entries++] = (struct table_entry){
-		.frequency = frequency,
-		.character = replacement,
-	};
 }
 
 
+struct table_column {
+	uint64_t first_seen;
+	unsigned char character;
+};
+
+
+static int table_column_cmp(const void *column_a, const void *column_b)
+{
+	uint64_t seen_a = ((struct table_column*)column_a)->first_seen;
+	uint64_t seen_b = ((struct table_column*)column_b)->first_seen;
+	return seen_a < seen_b ? -1 : seen_a > seen_b;
+}
+
+
+/* Writes every row as its nonzero counts in the order they were first seen */
 static void table_dump_to_file(struct table *table, FILE *fd)
 {
 	ENTER_FUNCTION_CB();
 	int i;
 	for (i=0x00; i<=0xFF; i++) {
-		int j;
-		char *space = "";
-		struct table_row row = table->rows[i];
-		fprintf(fd, "%d", row.n_entries);
-		for (j=0; j<row.n_entries; j++) {
-			struct table_entry entry = row.entries[j];
-			fprintf(fd, " %u:%llu", (unsigned int)entry.character,
-				entry.frequency);
-		}
+		int j, n_entries = 0;
+		struct table_column columns[256];
+		for (j=0x00; j<=0xFF; j++)
+			if (table->counts[i][j])
+				columns[n_entries++] = (struct table_column){
+					.first_seen = table->first_seen[i][j],
+					.character = j,
+				};
+		qsort(columns, n_entries, sizeof *columns, table_column_cmp);
+		fprintf(fd, "%d", n_entries);
+		for (j=0; j<n_entries; j++)
+			fprintf(fd, " %u:%llu", (unsigned int)columns[j].character,
+				(unsigned long long)
+				table->counts[i][columns[j].character]);
 		fprintf(fd, "\n");
 	}
 }
@@ -122,18 +174,16 @@ static void table_read_from_file(struct table *table, FILE *fd)
 	}
 
 	while (fgets(linebuf, 65536, fd)) {
-		int entry_idx = 0, n = 0;
+		int entry_idx = 0;
 		while (linebuf[0] != '\0') {
 			unsigned int character;
 			unsigned long long frequency;
 			sscanf(&linebuf[entry_idx], "%llu:%u", &frequency,
 			       &character);
-			table->rows[i].entries[n].frequency = frequency;
-			table->rows[i].entries[n].character = character;
+			table_new_add_cb(table, i, character, frequency);
 			entry_idx = get_next_entry_idx(entry_idx, linebuf);
 			if (entry_idx < 0)
 				break;
-			n += 1;
 		}
 		i += 1;
 	}
@@ -144,64 +194,246 @@ static void table_read_from_file(struct table *table, FILE *fd)
 }
 
 
-static void update_prefix_tree(char *word, char *pwd, int match_offset,
-			       struct avl_tree *prefix_tree)
+/* Bump allocator for strings that live as long as the arena */
+struct arena_block {
+	struct arena_block *next;
+	size_t used, size;
+	char data[];
+};
+
+struct arena {
+	struct arena_block *head;
+};
+
+
+static char *arena_strndup(struct arena *arena, const char *str, size_t len)
+{
+	ENTER_FUNCTION_CB();
+	struct arena_block *block = arena->head;
+	char *copy;
+
+	if (!block || block->size - block->used < len + 1) {
+		size_t size = len + 1 > ARENA_BLOCK_SIZE ? len + 1
+							 : ARENA_BLOCK_SIZE;
+		if (!(block = malloc(sizeof *block + size)))
+			return NULL;
+		block->used = 0;
+		block->size = size;
+		block->next = arena->head;
+		arena->head = block;
+	}
+	copy = block->data + block->used;
+	memcpy(copy, str, len);
+	copy[len] = '\0';
+	block->used += len + 1;
+	return copy;
+}
+
+
+static void arena_free(struct arena *arena)
+{
+	ENTER_FUNCTION_CB();
+	while (arena->head) {
+		struct arena_block *next = arena->head->next;
+		free(arena->head);
+		arena->head = next;
+	}
+}
+
+
+struct count_slot {
+	// NULL for an empty slot
+	char *key;
+	unsigned long long hash, count;
+};
+
+/*
+ * Occurrence counts of strings in an open addressing hash table with linear
+ * probing, kept at most half full. Keys are copied into an arena.
+ */
+struct count_map {
+	struct count_slot *slots;
+	size_t n_slots, n_entries;
+	struct arena arena;
+};
+
+
+static struct count_map *count_map_create(void)
+{
+	ENTER_FUNCTION_CB();
+	struct count_map *map;
+
+	if (!ALLOC(map, 1))
+		goto oom;
+	map->n_slots = COUNT_MAP_INITIAL_SLOTS;
+	map->n_entries = 0;
+	map->arena.head = NULL;
+	if (!(map->slots = calloc(map->n_slots, sizeof *map->slots))) {
+		free(map);
+		goto oom;
+	}
+	return map;
+ oom:
+	fprintf(stderr, "%s: Out of memory...\n", __func__);
+	return NULL;
+}
+
+
+static void count_map_destroy(struct count_map *map)
+{
+	ENTER_FUNCTION_CB();
+	if (!map)
+		return;
+	arena_free(&map->arena);
+	free(map->slots);
+	free(map);
+}
+
+
+static inline unsigned long long count_map_hash(const char *key, size_t len)
+{
+	// FNV-1a
+	unsigned long long hash = 0xcbf29ce484222325ULL;
+	size_t i;
+	for (i=0; i<len; i++)
+		hash = (hash ^ (unsigned char)key[i]) * 0x100000001b3ULL;
+	return hash;
+}
+
+
+static inline size_t count_map_slot(const struct count_map *map,
+				    unsigned long long hash)
+{
+	return (hash ^ hash >> 32) & (map->n_slots - 1);
+}
+
+
+static int count_map_grow(struct count_map *map)
+{
+	ENTER_FUNCTION_CB();
+	struct count_slot *old_slots = map->slots;
+	size_t i, old_n_slots = map->n_slots;
+
+	if (!(map->slots = calloc(2 * old_n_slots, sizeof *map->slots))) {
+		map->slots = old_slots;
+		return -1;
+	}
+	map->n_slots = 2 * old_n_slots;
+	for (i=0; i<old_n_slots; i++) {
+		size_t slot;
+		if (!old_slots[i].key)
+			continue;
+		slot = count_map_slot(map, old_slots[i].hash);
+		while (map->slots[slot].key)
+			slot = (slot + 1) & (map->n_slots - 1);
+		map->slots[slot] = old_slots[i];
+	}
+	free(old_slots);
+	return 0;
+}
+
+
+/* Adds count to the len characters at key, 0 if success, -1 otherwise */
+static int count_map_add(struct count_map *map, const char *key, size_t len,
+			 unsigned long long count)
+{
+	ENTER_FUNCTION_CB();
+	unsigned long long hash = count_map_hash(key, len);
+	size_t slot = count_map_slot(map, hash);
+	struct count_slot *entry;
+
+	for (; (entry = &map->slots[slot])->key;
+	     slot = (slot + 1) & (map->n_slots - 1))
+		if (entry->hash == hash && !strncmp(entry->key, key, len) &&
+		    entry->key[len] == '\0') {
+			entry->count += count;
+			return 0;
+		}
+	if (2 * (map->n_entries + 1) > map->n_slots) {
+		if (count_map_grow(map) < 0)
+			return -1;
+		return count_map_add(map, key, len, count);
+	}
+	if (!(entry->key = arena_strndup(&map->arena, key, len)))
+		return -1;
+	entry->hash = hash;
+	entry->count = count;
+	map->n_entries++;
+	return 0;
+}
+
+
+/* Adds the counts of src to map */
+static int count_map_merge(struct count_map *map, struct count_map *src)
+{
+	ENTER_FUNCTION_CB();
+	size_t i;
+	for (i=0; i<src->n_slots; i++) {
+		struct count_slot *entry = &src->slots[i];
+		if (entry->key && count_map_add(map, entry->key,
+						strlen(entry->key),
+						entry->count) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+
+static int count_slot_cmp(const void *slot_a, const void *slot_b)
+{
+	// Descending, the order the generator has always written keys in
+	return strcmp((*(struct count_slot**)slot_b)->key,
+		      (*(struct count_slot**)slot_a)->key);
+}
+
+
+/* Writes the entries sorted by key, 0 if success, -1 otherwise */
+static int count_map_dump_to_file(struct count_map *map, FILE *fd)
 {
 	ENTER_FUNCTION_CB();
-	struct avl_node *prefix_node;
-	char prefix[1024];
+	struct count_slot **sorted;
+	size_t i, n = 0;
+
+	if (!ALLOC(sorted, map->n_entries + 1))
+		return -1;
+	for (i=0; i<map->n_slots; i++)
+		if (map->slots[i].key)
+			sorted[n++] = &map->slots[i];
+	qsort(sorted, n, sizeof *sorted, count_slot_cmp);
+	for (i=0; i<n; i++)
+		fprintf(fd, ">%s\n%llu\n", sorted[i]->key, sorted[i]->count);
+	free(sorted);
+	return 0;
+}
 
-	if (match_offset >= sizeof prefix)
-		// Potential buffer overflow
+
+static void update_prefix_map(char *word, char *pwd, int match_offset,
+			      struct count_map *prefix_map)
+{
+	ENTER_FUNCTION_CB();
+	if (match_offset >= PREFIX_MAX_LEN)
 		return;
-	strncpy(prefix, pwd, match_offset);
-	prefix[match_offset] = '\0';
 #ifdef IGNORE_IDENTITY_PREFIX
-	if (prefix[0] == '\0')
+	if (match_offset == 0)
 		return;
 #endif /* IGNORE_IDENTITY_PREFIX */
-	if (!(prefix_node = avl_get_node(prefix_tree, prefix))) {
-		// Not found
-		char *prefix_insertion = strdup(prefix);
-		if (!prefix_insertion)
-			goto oom;
-		avl_insert(prefix_tree, prefix_insertion, 1);
-	} else
-		// Found
-		prefix_node->value += 1;
-
-	return;
- oom:
-	fprintf(stderr, "%s: Out of memory...\n", __func__);
-	return;
+	if (count_map_add(prefix_map, pwd, match_offset, 1) < 0)
+		fprintf(stderr, "%s: Out of memory...\n", __func__);
 }
 
 
-static void update_suffix_tree(char *word, char *pwd, int match_offset,
-			       struct avl_tree *suffix_tree)
+static void update_suffix_map(char *word, char *pwd, int match_offset,
+			      struct count_map *suffix_map)
 {
 	ENTER_FUNCTION_CB();
-	struct avl_node *suffix_node;
 	char *suffix = pwd + match_offset + strlen(word);
 
 #ifdef IGNORE_IDENTITY_SUFFIX
 	if (suffix[0] == '\0')
 		return;
 #endif /* IGNORE_IDENTITY_SUFFIX */
-	if (!(suffix_node = avl_get_node(suffix_tree, suffix))) {
-		// Not found
-		char *suffix_insertion = strdup(suffix);
-		if (!suffix_insertion)
-			goto oom;
-		avl_insert(suffix_tree, suffix_insertion, 1);
-	} else
-		// Found
-		suffix_node->value += 1;
-
-	return;
- oom:
-	fprintf(stderr, "%s: Out of memory...\n", __func__);
-	return;
+	if (count_map_add(suffix_map, suffix, strlen(suffix), 1) < 0)
+		fprintf(stderr, "%s: Out of memory...\n", __func__);
 }
 
 
@@ -242,14 +474,14 @@ static void update_normal_replacement_table(char *word, char *pwd,
 
 
 static void update_map_data(char *word, char *pwd, int match_offset,
-			    struct avl_tree *prefix_tree,
-			    struct avl_tree *suffix_tree,
+			    struct count_map *prefix_map,
+			    struct count_map *suffix_map,
 			    struct table *leading_replacement_table,
 			    struct table *normal_replacement_table)
 {
 	ENTER_FUNCTION_CB();
-	update_prefix_tree(word, pwd, match_offset, prefix_tree);
-	update_suffix_tree(word, pwd, match_offset, suffix_tree);
+	update_prefix_map(word, pwd, match_offset, prefix_map);
+	update_suffix_map(word, pwd, match_offset, suffix_map);
 	update_leading_replacement_table(word, pwd, match_offset,
 					 leading_replacement_table);
 	update_normal_replacement_table(word, pwd, match_offset,
@@ -269,7 +501,7 @@ static double match_index(char *word, char *pwd)
 }
 
 
-static double best_match(char *word, char *pwd, int *index)
+static double best_match_scalar(char *word, char *pwd, int *index)
 {
 	ENTER_FUNCTION_CB();
 	int offset, best_offset;
@@ -288,6 +520,442 @@ static double best_match(char *word, char *pwd, int *index)
 }
 
 
+#ifdef HAVE_X86_SIMD
+/*
+ * Copies word and pwd into buffers padded with MATCH_PADDING zero bytes for
+ * the vectorized kernels. Fails if they do not fit.
+ */
+static int pad_match_buffers(char *word, char *pwd, unsigned char *word_buf,
+			     unsigned char *pwd_buf, int *word_len,
+			     int *pwd_len)
+{
+	*word_len = strlen(word);
+	*pwd_len = strlen(pwd);
+	if (*word_len >= MATCH_MAX_LEN || *pwd_len >= MATCH_MAX_LEN)
+		return 0;
+	memcpy(word_buf, word, *word_len);
+	memset(word_buf + *word_len, 0, MATCH_PADDING);
+	memcpy(pwd_buf, pwd, *pwd_len);
+	memset(pwd_buf + *pwd_len, 0, MATCH_PADDING);
+	return 1;
+}
+
+
+/*
+ * Vectorized best_match: both strings are case-folded in place like tolower()
+ * does in the C locale, then the word is compared with one offset of the
+ * password per step, 16 (SSE2) or 32 (AVX2) characters at a time, with a byte
+ * compare and a popcount of the resulting mask. The first offset with the
+ * most matching characters wins and the match is computed as match_index
+ * does, so the results are identical to best_match_scalar.
+ */
+__attribute__((target("sse2")))
+static inline __m128i fold_sse2(__m128i c)
+{
+	// Only 'A' to 'Z' end up below -128 + 26 after the shift
+	__m128i upper = _mm_cmplt_epi8(_mm_add_epi8(c, _mm_set1_epi8(0x80 - 'A')),
+				       _mm_set1_epi8((char)(0x80 + 26)));
+	return _mm_or_si128(c, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+}
+
+
+__attribute__((target("sse2")))
+static double best_match_sse2(char *word, char *pwd, int *index)
+{
+	ENTER_FUNCTION_CB();
+	unsigned char word_buf[MATCH_MAX_LEN + MATCH_PADDING];
+	unsigned char pwd_buf[MATCH_MAX_LEN + MATCH_PADDING];
+	int word_len, pwd_len, offset, i, best = -1, best_offset = 0;
+	unsigned int tail_mask;
+
+	if (!pad_match_buffers(word, pwd, word_buf, pwd_buf, &word_len,
+			       &pwd_len))
+		return best_match_scalar(word, pwd, index);
+	*index = 0;
+	if (word_len == 0 || word_len > pwd_len)
+		// No offset with a defined match, see match_index
+		return -1.0;
+	for (i=0; i<word_len; i+=16) {
+		__m128i *chunk = (__m128i*)&word_buf[i];
+		_mm_storeu_si128(chunk, fold_sse2(_mm_loadu_si128(chunk)));
+	}
+	for (i=0; i<pwd_len; i+=16) {
+		__m128i *chunk = (__m128i*)&pwd_buf[i];
+		_mm_storeu_si128(chunk, fold_sse2(_mm_loadu_si128(chunk)));
+	}
+	tail_mask = word_len % 16 ? (1u << word_len % 16) - 1 : 0xffff;
+
+	for (offset = 0; offset <= pwd_len - word_len; offset++) {
+		int matching = 0;
+		for (i=0; i<word_len; i+=16) {
+			__m128i w = _mm_loadu_si128((__m128i*)&word_buf[i]);
+			__m128i p = _mm_loadu_si128(
+				(__m128i*)&pwd_buf[offset + i]);
+			unsigned int mask = _mm_movemask_epi8(
+				_mm_cmpeq_epi8(w, p));
+			if (i + 16 >= word_len)
+				mask &= tail_mask;
+			matching += __builtin_popcount(mask);
+		}
+		if (best < matching) {
+			best = matching;
+			best_offset = offset;
+			if (best == word_len)
+				// Later offsets can only tie
+				break;
+		}
+	}
+	*index = best_offset;
+	return (double)best / (double)word_len;
+}
+
+
+__attribute__((target("avx2")))
+static inline __m256i fold_avx2(__m256i c)
+{
+	// Only 'A' to 'Z' end up below -128 + 26 after the shift
+	__m256i upper = _mm256_cmpgt_epi8(
+		_mm256_set1_epi8((char)(0x80 + 26)),
+		_mm256_add_epi8(c, _mm256_set1_epi8(0x80 - 'A')));
+	return _mm256_or_si256(c, _mm256_and_si256(upper,
+						   _mm256_set1_epi8(0x20)));
+}
+
+
+__attribute__((target("avx2,popcnt")))
+static double best_match_avx2(char *word, char *pwd, int *index)
+{
+	ENTER_FUNCTION_CB();
+	unsigned char word_buf[MATCH_MAX_LEN + MATCH_PADDING];
+	unsigned char pwd_buf[MATCH_MAX_LEN + MATCH_PADDING];
+	int word_len, pwd_len, offset, i, best = -1, best_offset = 0;
+	unsigned int tail_mask;
+
+	if (!pad_match_buffers(word, pwd, word_buf, pwd_buf, &word_len,
+			       &pwd_len))
+		return best_match_scalar(word, pwd, index);
+	*index = 0;
+	if (word_len == 0 || word_len > pwd_len)
+		// No offset with a defined match, see match_index
+		return -1.0;
+	for (i=0; i<word_len; i+=32) {
+		__m256i *chunk = (__m256i*)&word_buf[i];
+		_mm256_storeu_si256(chunk,
+				    fold_avx2(_mm256_loadu_si256(chunk)));
+	}
+	for (i=0; i<pwd_len; i+=32) {
+		__m256i *chunk = (__m256i*)&pwd_buf[i];
+		_mm256_storeu_si256(chunk,
+				    fold_avx2(_mm256_loadu_si256(chunk)));
+	}
+	tail_mask = word_len % 32 ? (1u << word_len % 32) - 1 : ~0u;
+
+	for (offset = 0; offset <= pwd_len - word_len; offset++) {
+		int matching = 0;
+		for (i=0; i<word_len; i+=32) {
+			__m256i w = _mm256_loadu_si256((__m256i*)&word_buf[i]);
+			__m256i p = _mm256_loadu_si256(
+				(__m256i*)&pwd_buf[offset + i]);
+			unsigned int mask = _mm256_movemask_epi8(
+				_mm256_cmpeq_epi8(w, p));
+			if (i + 32 >= word_len)
+				mask &= tail_mask;
+			matching += __builtin_popcount(mask);
+		}
+		if (best < matching) {
+			best = matching;
+			best_offset = offset;
+			if (best == word_len)
+				// Later offsets can only tie
+				break;
+		}
+	}
+	*index = best_offset;
+	return (double)best / (double)word_len;
+}
+#endif /* HAVE_X86_SIMD */
+
+
+static double (*best_match)(char *word, char *pwd, int *index) =
+	best_match_scalar;
+
+
+/* Picks the fastest best_match kernel the CPU supports */
+static void select_match_kernel(void)
+{
+	ENTER_FUNCTION_CB();
+#ifdef HAVE_X86_SIMD
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt"))
+		best_match = best_match_avx2;
+	else if (__builtin_cpu_supports("sse2"))
+		best_match = best_match_sse2;
+#endif /* HAVE_X86_SIMD */
+}
+
+
+/*
+ * Most mismatching characters a word of word_len characters can have at an
+ * offset and still meet WORDMATCH_CRITERION, computed like match_index does
+ */
+static int max_mismatches(int word_len)
+{
+	int mismatches = 0;
+	while (mismatches < word_len &&
+	       (double)(word_len - mismatches - 1) / (double)word_len >=
+	       WORDMATCH_CRITERION)
+		mismatches++;
+	return mismatches;
+}
+
+
+struct index_posting {
+	unsigned long long key;
+	int word, word_len;
+	// Position of the piece the key was taken from in the word
+	int piece_offset;
+};
+
+/*
+ * Wordlist index for finding the words a password can match. A word that
+ * meets WORDMATCH_CRITERION at some offset has at most max_mismatches()
+ * mismatching characters there, so when it is cut into that many pieces plus
+ * one, at least one piece matches exactly. The index maps the case-folded
+ * leading q-gram of every piece (INDEX_MAX_Q characters or the whole piece if
+ * shorter) to the word, and a password is only compared with the words one of
+ * its q-grams leads to at a feasible offset. No word that would match is
+ * missed, and candidates are visited in wordlist order, so the result is the
+ * same as comparing every word.
+ */
+struct word_index {
+	char **words;
+	int n_words;
+	// Postings sorted by key, and an open addressing table of 1 + the
+	// position of the first posting of every key (0 for empty slots)
+	struct index_posting *postings;
+	size_t n_postings;
+	size_t *slots;
+	size_t slot_mask;
+	// Bit q - 1 is set if there are keys of q characters
+	unsigned int q_lengths;
+	// Words compared with every password, as any offset meets the criterion
+	int *unfiltered;
+	int n_unfiltered;
+	unsigned char fold[256];
+};
+
+/* Per thread state of word_index_lookup() */
+struct index_scratch {
+	// Serial number of the last password each word was a candidate for
+	unsigned int *seen;
+	unsigned int serial;
+	int *candidates;
+};
+
+
+static inline unsigned long long index_key(unsigned int packed, int q)
+{
+	return (unsigned long long)q << 32 | packed;
+}
+
+
+static inline size_t index_hash(const struct word_index *index,
+				unsigned long long key)
+{
+	return (key * 0x9e3779b97f4a7c15ULL >> 17) & index->slot_mask;
+}
+
+
+static int index_posting_cmp(const void *posting_a, const void *posting_b)
+{
+	const struct index_posting *a = posting_a, *b = posting_b;
+	if (a->key != b->key)
+		return a->key < b->key ? -1 : 1;
+	return a->word - b->word;
+}
+
+
+static int int_cmp(const void *int_a, const void *int_b)
+{
+	return *(const int*)int_a - *(const int*)int_b;
+}
+
+
+static void word_index_destroy(struct word_index *index)
+{
+	ENTER_FUNCTION_CB();
+	if (!index)
+		return;
+	free(index->postings);
+	free(index->slots);
+	free(index->unfiltered);
+	free(index);
+}
+
+
+static struct word_index *word_index_create(char **words, int n_words)
+{
+	ENTER_FUNCTION_CB();
+	int i, j, c;
+	size_t n_keys = 0, n_slots = 1, n;
+	struct word_index *index;
+
+	if (!(index = calloc(1, sizeof *index)))
+		goto oom;
+	index->words = words;
+	index->n_words = n_words;
+	for (c=0x00; c<=0xFF; c++)
+		index->fold[c] = tolower((char)c);
+	for (i=0; i<n_words; i++) {
+		int word_len = strlen(words[i]);
+		index->n_postings += max_mismatches(word_len) + 1;
+	}
+	if (!ALLOC(index->postings, index->n_postings + 1) ||
+	    !ALLOC(index->unfiltered, n_words + 1))
+		goto oom;
+
+	n = 0;
+	for (i=0; i<n_words; i++) {
+		int word_len = strlen(words[i]);
+		int n_pieces = max_mismatches(word_len) + 1;
+		if (word_len == 0)
+			// Never matches, see match_index
+			continue;
+		if (n_pieces > word_len) {
+			index->unfiltered[index->n_unfiltered++] = i;
+			continue;
+		}
+		for (j=0; j<n_pieces; j++) {
+			int start = j * word_len / n_pieces;
+			int end = (j + 1) * word_len / n_pieces;
+			int k, q = end - start;
+			unsigned int packed = 0;
+			if (q > INDEX_MAX_Q)
+				q = INDEX_MAX_Q;
+			for (k=0; k<q; k++)
+				packed |= (unsigned int)index->fold[
+					(unsigned char)words[i][start + k]] <<
+					(8 * k);
+			index->q_lengths |= 1u << (q - 1);
+			index->postings[n++] = (struct index_posting){
+				.key = index_key(packed, q),
+				.word = i,
+				.word_len = word_len,
+				.piece_offset = start,
+			};
+		}
+	}
+	index->n_postings = n;
+	qsort(index->postings, n, sizeof *index->postings, index_posting_cmp);
+
+	for (n=0; n<index->n_postings; n++)
+		if (n == 0 || index->postings[n].key !=
+			      index->postings[n - 1].key)
+			n_keys++;
+	while (n_slots < 2 * n_keys)
+		n_slots <<= 1;
+	if (!(index->slots = calloc(n_slots, sizeof *index->slots)))
+		goto oom;
+	index->slot_mask = n_slots - 1;
+	for (n=0; n<index->n_postings; n++) {
+		size_t slot;
+		unsigned long long key = index->postings[n].key;
+		if (n > 0 && key == index->postings[n - 1].key)
+			continue;
+		slot = index_hash(index, key);
+		while (index->slots[slot])
+			slot = (slot + 1) & index->slot_mask;
+		index->slots[slot] = n + 1;
+	}
+	return index;
+ oom:
+	fprintf(stderr, "%s: Out of memory...\n", __func__);
+	word_index_destroy(index);
+	return NULL;
+}
+
+
+static int index_scratch_init(struct index_scratch *scratch,
+			      const struct word_index *index)
+{
+	ENTER_FUNCTION_CB();
+	scratch->serial = 0;
+	scratch->seen = calloc(index->n_words + 1, sizeof *scratch->seen);
+	ALLOC(scratch->candidates, index->n_words + 1);
+	if (scratch->seen && scratch->candidates)
+		return 0;
+	fprintf(stderr, "%s: Out of memory...\n", __func__);
+	free(scratch->seen);
+	free(scratch->candidates);
+	return -1;
+}
+
+
+static void index_scratch_free(struct index_scratch *scratch)
+{
+	ENTER_FUNCTION_CB();
+	free(scratch->seen);
+	free(scratch->candidates);
+}
+
+
+/*
+ * Fills scratch->candidates with the indices of the words pwd may match, in
+ * wordlist order, and returns their number.
+ */
+static int word_index_lookup(const struct word_index *index, char *pwd,
+			     struct index_scratch *scratch)
+{
+	ENTER_FUNCTION_CB();
+	int p, q, n_candidates = 0, pwd_len = strlen(pwd);
+
+	if (++scratch->serial == 0) {
+		memset(scratch->seen, 0,
+		       index->n_words * sizeof *scratch->seen);
+		scratch->serial = 1;
+	}
+	for (p=0; p<index->n_unfiltered; p++)
+		scratch->candidates[n_candidates++] = index->unfiltered[p];
+
+	for (p=0; p<pwd_len; p++) {
+		unsigned int packed = 0;
+		for (q=1; q<=INDEX_MAX_Q && p + q <= pwd_len; q++) {
+			size_t slot, n;
+			unsigned long long key;
+			packed |= (unsigned int)index->fold[
+				(unsigned char)pwd[p + q - 1]] << (8 * (q - 1));
+			if (!(index->q_lengths & 1u << (q - 1)))
+				continue;
+			key = index_key(packed, q);
+			for (slot = index_hash(index, key); index->slots[slot];
+			     slot = (slot + 1) & index->slot_mask)
+				if (index->postings[index->slots[slot] - 1].key ==
+				    key)
+					break;
+			if (!index->slots[slot])
+				continue;
+			for (n = index->slots[slot] - 1;
+			     n < index->n_postings &&
+			     index->postings[n].key == key; n++) {
+				const struct index_posting *posting =
+					&index->postings[n];
+				int offset = p - posting->piece_offset;
+				if (offset < 0 ||
+				    offset > pwd_len - posting->word_len ||
+				    scratch->seen[posting->word] ==
+				    scratch->serial)
+					continue;
+				scratch->seen[posting->word] = scratch->serial;
+				scratch->candidates[n_candidates++] =
+					posting->word;
+			}
+		}
+	}
+	qsort(scratch->candidates, n_candidates, sizeof(int), int_cmp);
+	return n_candidates;
+}
+
+
 static inline void remove_trailing_newline(char *text)
 {
 	ENTER_FUNCTION_CB();
@@ -297,64 +965,397 @@ static inline void remove_trailing_newline(char *text)
 }
 
 
-static void accumulate_map_data(char **words, int n_words,
-				struct avl_tree *prefix_tree,
-				struct avl_tree *suffix_tree,
+/* Growable buffer the lines of a mapped file are terminated in */
+struct line_buffer {
+	char *text;
+	size_t size;
+};
+
+
+/* Copies the len characters at text into line, NULL if out of memory */
+static char *line_buffer_set(struct line_buffer *line, const char *text,
+			     size_t len)
+{
+	if (len >= line->size) {
+		size_t size = line->size ? line->size : LINE_BUFFER_SIZE;
+		char *grown;
+		while (len >= size)
+			size *= 2;
+		if (!(grown = realloc(line->text, size)))
+			return NULL;
+		line->text = grown;
+		line->size = size;
+	}
+	memcpy(line->text, text, len);
+	line->text[len] = '\0';
+	return line->text;
+}
+
+
+static void accumulate_password(const struct word_index *index,
+				struct index_scratch *scratch, char *pwd,
+				struct count_map *prefix_map,
+				struct count_map *suffix_map,
 				struct table *leading_replacement_table,
 				struct table *normal_replacement_table)
+{
+	ENTER_FUNCTION_CB();
+	int i, match_offset;
+	int n_candidates = word_index_lookup(index, pwd, scratch);
+	for (i=0; i<n_candidates; i++) {
+		char *word = index->words[scratch->candidates[i]];
+		double match = best_match(word, pwd, &match_offset);
+		if (match < WORDMATCH_CRITERION)
+			continue;
+		update_map_data(word, pwd, match_offset, prefix_map,
+				suffix_map, leading_replacement_table,
+				normal_replacement_table);
+	}
+}
+
+
+/*
+ * Accumulates the newline separated passwords in the len bytes at text, which
+ * is never written to. Lines may be of any length.
+ */
+static int accumulate_lines(const struct word_index *index,
+			    struct index_scratch *scratch,
+			    struct line_buffer *line, const char *text,
+			    size_t len, struct count_map *prefix_map,
+			    struct count_map *suffix_map,
+			    struct table *leading_replacement_table,
+			    struct table *normal_replacement_table)
+{
+	ENTER_FUNCTION_CB();
+	const char *end = text + len;
+
+	while (text < end) {
+		const char *lf = memchr(text, '\n', end - text);
+		char *pwd;
+		if (!lf)
+			lf = end;
+		if (!(pwd = line_buffer_set(line, text, lf - text)))
+			return -1;
+		accumulate_password(index, scratch, pwd, prefix_map,
+				    suffix_map, leading_replacement_table,
+				    normal_replacement_table);
+		text = lf + 1;
+	}
+	return 0;
+}
+
+
+/*
+ * Accumulates the passwords of the input_len bytes mapped at input, or of
+ * stdin if input is NULL.
+ */
+static int accumulate_map_data(const struct word_index *index,
+			       const char *input, size_t input_len,
+			       struct count_map *prefix_map,
+			       struct count_map *suffix_map,
+			       struct table *leading_replacement_table,
+			       struct table *normal_replacement_table)
 {
 	ENTER_FUNCTION_CB();
 	char pwd[1024];
-	while (fgets(pwd, sizeof pwd, stdin)) {
-		int i, match_offset;
-		remove_trailing_newline(pwd);
-		for (i=0; i<n_words; i++) {
-			char *word = words[i];
-			double match = best_match(word, pwd, &match_offset);
-			if (match < WORDMATCH_CRITERION)
-				continue;
-			update_map_data(word, pwd, match_offset, prefix_tree,
-					suffix_tree, leading_replacement_table,
-					normal_replacement_table);
+	int res = 0;
+	struct index_scratch scratch;
+	struct line_buffer line = {NULL, 0};
+
+	if (index_scratch_init(&scratch, index) < 0)
+		return -1;
+	if (input) {
+		if ((res = accumulate_lines(index, &scratch, &line, input,
+					    input_len, prefix_map, suffix_map,
+					    leading_replacement_table,
+					    normal_replacement_table)) < 0)
+			fprintf(stderr, "%s: Out of memory...\n", __func__);
+	} else {
+		while (fgets(pwd, sizeof pwd, stdin)) {
+			remove_trailing_newline(pwd);
+			accumulate_password(index, &scratch, pwd, prefix_map,
+					    suffix_map,
+					    leading_replacement_table,
+					    normal_replacement_table);
 		}
 	}
+	free(line.text);
+	index_scratch_free(&scratch);
+	return res;
 }
 
 
-static int dump_avl_node(char *pwd, unsigned long long frequency,
-			 void *cb_data)
+/*
+ * Passwords exactly as the serial loop reads them with fgets, stored one
+ * after the other with their terminating NUL, or whole lines of a mapped
+ * input.
+ */
+struct chunk {
+	char *text;
+	// Lines of the mapped input in place of text
+	const char *lines;
+	size_t used;
+	// Position of the chunk in the input
+	unsigned long long index;
+	struct chunk *next;
+};
+
+struct chunk_queue {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	// Filled chunks in input order, and empty ones
+	struct chunk *ready_head, *ready_tail, *spare;
+	int done;
+};
+
+struct worker {
+	pthread_t thread;
+	struct chunk_queue *queue;
+	const struct word_index *index;
+	struct index_scratch scratch;
+	struct line_buffer line;
+	struct count_map *prefix_map, *suffix_map;
+	struct table *leading_replacement_table, *normal_replacement_table;
+	// Set if the worker ran out of memory
+	int failed;
+};
+
+
+static struct chunk *chunk_queue_pop(struct chunk_queue *queue)
 {
-	ENTER_FUNCTION_CB();
-	fprintf(stdout, ">%s\n%llu\n", pwd, frequency);
+	struct chunk *chunk;
+	pthread_mutex_lock(&queue->lock);
+	while (!queue->ready_head && !queue->done)
+		pthread_cond_wait(&queue->cond, &queue->lock);
+	if ((chunk = queue->ready_head) &&
+	    !(queue->ready_head = chunk->next))
+		queue->ready_tail = NULL;
+	pthread_mutex_unlock(&queue->lock);
+	return chunk;
 }
 
 
-static int __return_1(char *key, unsigned long long val, void *cb_data)
+static void chunk_queue_push(struct chunk_queue *queue, struct chunk *chunk)
 {
-	return 1;
+	pthread_mutex_lock(&queue->lock);
+	chunk->next = NULL;
+	if (queue->ready_tail)
+		queue->ready_tail->next = chunk;
+	else
+		queue->ready_head = chunk;
+	queue->ready_tail = chunk;
+	pthread_cond_broadcast(&queue->cond);
+	pthread_mutex_unlock(&queue->lock);
 }
 
 
-static int avl_tree_size(struct avl_tree *tree)
+static struct chunk *chunk_queue_get_spare(struct chunk_queue *queue)
 {
-	return avl_traverse(tree, __return_1, NULL);
+	struct chunk *chunk;
+	pthread_mutex_lock(&queue->lock);
+	while (!queue->spare)
+		pthread_cond_wait(&queue->cond, &queue->lock);
+	chunk = queue->spare;
+	queue->spare = chunk->next;
+	pthread_mutex_unlock(&queue->lock);
+	return chunk;
+}
+
+
+static void chunk_queue_put_spare(struct chunk_queue *queue,
+				  struct chunk *chunk)
+{
+	pthread_mutex_lock(&queue->lock);
+	chunk->next = queue->spare;
+	queue->spare = chunk;
+	pthread_cond_broadcast(&queue->cond);
+	pthread_mutex_unlock(&queue->lock);
+}
+
+
+/*
+ * Table counts are numbered by the chunk they were first seen in and then
+ * by their order within it, so once the tables of all workers are merged,
+ * sorting by first_seen restores the order of the serial run.
+ */
+static void *worker_run(void *arg)
+{
+	ENTER_FUNCTION_CB();
+	struct worker *worker = arg;
+	struct chunk *chunk;
+
+	while ((chunk = chunk_queue_pop(worker->queue))) {
+		char *pwd, *end;
+		worker->leading_replacement_table->sequence =
+			chunk->index << 32;
+		worker->normal_replacement_table->sequence =
+			chunk->index << 32;
+		if (chunk->lines) {
+			if (accumulate_lines(worker->index, &worker->scratch,
+					     &worker->line, chunk->lines,
+					     chunk->used, worker->prefix_map,
+					     worker->suffix_map,
+					     worker->leading_replacement_table,
+					     worker->normal_replacement_table)
+			    < 0)
+				worker->failed = 1;
+			chunk_queue_put_spare(worker->queue, chunk);
+			continue;
+		}
+		for (pwd = chunk->text, end = pwd + chunk->used; pwd < end; ) {
+			char *next = pwd + strlen(pwd) + 1;
+			remove_trailing_newline(pwd);
+			accumulate_password(worker->index, &worker->scratch,
+					    pwd, worker->prefix_map,
+					    worker->suffix_map,
+					    worker->leading_replacement_table,
+					    worker->normal_replacement_table);
+			pwd = next;
+		}
+		chunk_queue_put_spare(worker->queue, chunk);
+	}
+	return NULL;
 }
 
 
-static void dump_map_data(struct avl_tree *prefix_tree,
-			  struct avl_tree *suffix_tree,
+/*
+ * Same as accumulate_map_data, but with the input split in chunks that
+ * n_threads workers accumulate into maps and tables of their own, which are
+ * merged into the given ones at the end. Chunks of a mapped input are cut at
+ * the first line break CHUNK_SIZE bytes in and are not copied.
+ */
+static int accumulate_map_data_parallel(const struct word_index *index,
+					int n_threads, const char *input,
+					size_t input_len,
+					struct count_map *prefix_map,
+					struct count_map *suffix_map,
+					struct table *leading_replacement_table,
+					struct table *normal_replacement_table)
+{
+	ENTER_FUNCTION_CB();
+	int i, n_started, n_chunks = CHUNKS_PER_WORKER * n_threads, ret = -1;
+	unsigned long long chunk_idx;
+	size_t input_offset = 0;
+	struct chunk_queue queue = {
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+		.cond = PTHREAD_COND_INITIALIZER,
+	};
+	struct chunk *chunks = NULL;
+	struct worker *workers = NULL;
+
+	if (!(chunks = calloc(n_chunks, sizeof *chunks)) ||
+	    !(workers = calloc(n_threads, sizeof *workers)))
+		goto oom;
+	for (i=0; i<n_chunks; i++) {
+		if (!input && !ALLOC(chunks[i].text, CHUNK_SIZE))
+			goto oom;
+		chunk_queue_put_spare(&queue, &chunks[i]);
+	}
+	for (i=0; i<n_threads; i++) {
+		struct worker *worker = &workers[i];
+		worker->queue = &queue;
+		if (index_scratch_init(&worker->scratch, index) < 0)
+			goto out;
+		worker->index = index;
+		if (!(worker->prefix_map = count_map_create()) ||
+		    !(worker->suffix_map = count_map_create()) ||
+		    !(worker->leading_replacement_table =
+			      table_create_empty()) ||
+		    !(worker->normal_replacement_table =
+			      table_create_empty()))
+			goto oom;
+	}
+	for (n_started=0; n_started<n_threads; n_started++)
+		if (pthread_create(&workers[n_started].thread, NULL,
+				   worker_run, &workers[n_started])) {
+			fprintf(stderr, "%s: Failed to start thread...\n",
+				__func__);
+			break;
+		}
+
+	for (chunk_idx=0; n_started > 0; chunk_idx++) {
+		struct chunk *chunk = chunk_queue_get_spare(&queue);
+		chunk->used = 0;
+		chunk->index = chunk_idx;
+		if (input) {
+			const char *lf = NULL;
+			chunk->lines = input + input_offset;
+			chunk->used = input_len - input_offset;
+			if (chunk->used > CHUNK_SIZE)
+				lf = memchr(chunk->lines + CHUNK_SIZE - 1, '\n',
+					    chunk->used - CHUNK_SIZE + 1);
+			if (lf)
+				chunk->used = lf + 1 - chunk->lines;
+			input_offset += chunk->used;
+		}
+		while (!input && CHUNK_SIZE - chunk->used >= 1024 &&
+		       fgets(chunk->text + chunk->used, 1024, stdin))
+			chunk->used += strlen(chunk->text + chunk->used) + 1;
+		if (chunk->used == 0) {
+			chunk_queue_put_spare(&queue, chunk);
+			break;
+		}
+		chunk_queue_push(&queue, chunk);
+	}
+	pthread_mutex_lock(&queue.lock);
+	queue.done = 1;
+	pthread_cond_broadcast(&queue.cond);
+	pthread_mutex_unlock(&queue.lock);
+	for (i=0; i<n_started; i++)
+		pthread_join(workers[i].thread, NULL);
+
+	for (i=0; i<n_started; i++) {
+		struct worker *worker = &workers[i];
+		if (worker->failed ||
+		    count_map_merge(prefix_map, worker->prefix_map) < 0 ||
+		    count_map_merge(suffix_map, worker->suffix_map) < 0)
+			goto oom;
+		table_merge(leading_replacement_table,
+			    worker->leading_replacement_table);
+		table_merge(normal_replacement_table,
+			    worker->normal_replacement_table);
+	}
+	if (n_started > 0)
+		ret = 0;
+	goto out;
+ oom:
+	fprintf(stderr, "%s: Out of memory...\n", __func__);
+ out:
+	for (i=0; workers && i<n_threads; i++) {
+		count_map_destroy(workers[i].prefix_map);
+		count_map_destroy(workers[i].suffix_map);
+		free(workers[i].leading_replacement_table);
+		free(workers[i].normal_replacement_table);
+		free(workers[i].line.text);
+		if (workers[i].index)
+			index_scratch_free(&workers[i].scratch);
+	}
+	for (i=0; chunks && i<n_chunks; i++)
+		free(chunks[i].text);
+	free(workers);
+	free(chunks);
+	pthread_cond_destroy(&queue.cond);
+	pthread_mutex_destroy(&queue.lock);
+	return ret;
+}
+
+
+static void dump_map_data(struct count_map *prefix_map,
+			  struct count_map *suffix_map,
 			  struct table *leading_replacement_table,
 			  struct table *normal_replacement_table)
 {
 	ENTER_FUNCTION_CB();
 	fprintf(stdout, ":prefix:\n");
-	fprintf(stdout, "START %d\n", avl_tree_size(prefix_tree));
-	avl_traverse(prefix_tree, dump_avl_node, NULL);
+	fprintf(stdout, "START %zu\n", prefix_map->n_entries);
+	if (count_map_dump_to_file(prefix_map, stdout) < 0)
+		goto oom;
 	fprintf(stdout, "END\n");
 
 	fprintf(stdout, ":suffix:\n");
-	fprintf(stdout, "START %d\n", avl_tree_size(suffix_tree));
-	avl_traverse(suffix_tree, dump_avl_node, NULL);
+	fprintf(stdout, "START %zu\n", suffix_map->n_entries);
+	if (count_map_dump_to_file(suffix_map, stdout) < 0)
+		goto oom;
 	fprintf(stdout, "END\n");
 
 	fprintf(stdout, ":leading:\n");
@@ -366,126 +1367,176 @@ static void dump_map_data(struct avl_tree *prefix_tree,
 	fprintf(stdout, "START %d\n", 256);
 	table_dump_to_file(normal_replacement_table, stdout);
 	fprintf(stdout, "END\n");
+	return;
+ oom:
+	fprintf(stderr, "%s: Out of memory...\n", __func__);
 }
 
 
-static int __avl_strcmp(char *str_a, char *str_b)
+/*
+ * Maps filename read-only and sets len to its size. Empty files are not
+ * mapped and give an empty string.
+ */
+static const char *map_file(const char *filename, size_t *len)
 {
 	ENTER_FUNCTION_CB();
-	return strcmp(str_a, str_b);
-}
+	int fd;
+	struct stat st;
+	void *data;
 
-static void __avl_free(char *ptr)
-{
-	ENTER_FUNCTION_CB();
-	return free(ptr);
-}
-
-static void stub(unsigned long long frequency)
-{
-	ENTER_FUNCTION_CB();
-	return;
+	if ((fd = open(filename, O_RDONLY)) < 0)
+		goto badfd;
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+		close(fd);
+		goto badfd;
+	}
+	if ((*len = st.st_size) == 0) {
+		close(fd);
+		return "";
+	}
+	data = mmap(NULL, *len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+		goto badfd;
+	madvise(data, *len, MADV_SEQUENTIAL);
+	return data;
+ badfd:
+	fprintf(stderr, "%s: Failed to map file %s...\n", __func__, filename);
+	return NULL;
 }
 
 
-static int get_linecount(char *filename)
+static void unmap_file(const char *data, size_t len)
 {
 	ENTER_FUNCTION_CB();
-	FILE *fd;
-	int linecount = 0;
-	char linebuf[1024];
-
-	if (!(fd = fopen(filename, "rb"))) {
-		fprintf(stderr, "%s: Failed to open file %s...\n", __func__,
-			filename);
-		return -1;
-	}
-	while (fgets(linebuf, sizeof linebuf, fd))
-		linecount += 1;
-
-	fclose(fd);
-	return linecount;
+	if (len)
+		munmap((void*)data, len);
 }
 
 
-static int gen_map_data(char *filename, struct avl_tree *prefix_tree,
-			 struct avl_tree *suffix_tree,
-			 struct table *leading_replacement_table,
-			 struct table *normal_replacement_table)
+/*
+ * Reads the wordlist in a single pass over its mapping, then accumulates the
+ * passwords of password_file, or of stdin if it is NULL.
+ */
+static int gen_map_data(char *filename, char *password_file, int n_threads,
+			struct count_map *prefix_map,
+			struct count_map *suffix_map,
+			struct table *leading_replacement_table,
+			struct table *normal_replacement_table)
 {
 	ENTER_FUNCTION_CB();
-	FILE *fd;
-	int linecount, n_words=0;
-	char **words, word[1024];
-
-	if ((linecount = get_linecount(filename)) < 0)
-		goto badfd;
-	if (!(fd = fopen(filename, "rb")))
-		goto badfd;
-	if (!ALLOC(words, linecount))
-		goto oom;
-
-	while (fgets(word, sizeof word, fd) && n_words < linecount) {
-		remove_trailing_newline(word);
-		if (!(words[n_words++] = strdup(word)))
+	const char *wordlist, *line, *end, *passwords = NULL;
+	size_t wordlist_len, passwords_len = 0;
+	int n_words = 0, max_words = 0, res = -1;
+	char **words = NULL;
+	struct arena arena = {NULL};
+	struct word_index *index;
+
+	if (!(wordlist = map_file(filename, &wordlist_len)))
+		return -1;
+	for (line = wordlist, end = wordlist + wordlist_len; line < end; ) {
+		const char *lf = memchr(line, '\n', end - line);
+		if (!lf)
+			lf = end;
+		if (n_words == max_words) {
+			char **grown;
+			max_words = max_words ? 2 * max_words : 1024;
+			if (!(grown = realloc(words, max_words * sizeof *words)))
+				goto oom;
+			words = grown;
+		}
+		if (!(words[n_words++] = arena_strndup(&arena, line,
+							lf - line)))
 			goto oom;
+		line = lf + 1;
 	}
 
-	accumulate_map_data(words, n_words, prefix_tree, suffix_tree,
-			    leading_replacement_table,
-			    normal_replacement_table);
- out:
-	while (n_words --> 0)
-		free(words[n_words]);
-	free(words);
-	fclose(fd);
-	return 0;
- badfd:
-	fprintf(stderr, "%s: Failed to open file %s...\n", __func__, filename);
-	return -1;
+	if (password_file &&
+	    !(passwords = map_file(password_file, &passwords_len)))
+		goto out;
+	if (!(index = word_index_create(words, n_words)))
+		goto out;
+	if (n_threads > 1)
+		res = accumulate_map_data_parallel(index, n_threads, passwords,
+						   passwords_len, prefix_map,
+						   suffix_map,
+						   leading_replacement_table,
+						   normal_replacement_table);
+	else
+		res = accumulate_map_data(index, passwords, passwords_len,
+					  prefix_map, suffix_map,
+					  leading_replacement_table,
+					  normal_replacement_table);
+	word_index_destroy(index);
+	goto out;
  oom:
 	fprintf(stderr, "%s: Out of memory...\n", __func__);
-	fclose(fd);
-	return -1;
+ out:
+	if (passwords)
+		unmap_file(passwords, passwords_len);
+	unmap_file(wordlist, wordlist_len);
+	arena_free(&arena);
+	free(words);
+	return res;
 }
 
 
 int main(int argc, char *argv[])
 {
 	ENTER_FUNCTION_CB();
-	int res;
-	char *wordlist;
-	struct avl_tree *prefix_tree, *suffix_tree;
+	int res, opt, n_threads = 1;
+	char *wordlist, *password_file = NULL, *end;
+	struct count_map *prefix_map, *suffix_map;
 	struct table *leading_replacement_table, *normal_replacement_table;
 
-	if (argc != 2) {
-		fprintf(stderr, "Usage: cat <password data> | %s <wordlist to "
-			"compare> > <output file>\n", argv[0]);
-		return -1;
+	while ((opt = getopt(argc, argv, "p:t:")) != -1) {
+		switch (opt) {
+		case 'p':
+			password_file = optarg;
+			break;
+		case 't':
+			n_threads = strtol(optarg, &end, 10);
+			if (*optarg != '\0' && *end == '\0' && n_threads >= 1)
+				break;
+			fprintf(stderr, "Invalid thread count \"%s\"\n",
+				optarg);
+			return -1;
+		default:
+			goto usage;
+		}
 	}
+	if (argc - optind != 1)
+		goto usage;
 
-	wordlist = argv[1];
-	if (!(prefix_tree = avl_create_tree(__avl_strcmp, __avl_free, stub)) ||
-	    !(suffix_tree = avl_create_tree(__avl_strcmp, __avl_free, stub)) ||
+	wordlist = argv[optind];
+	select_match_kernel();
+	if (!(prefix_map = count_map_create()) ||
+	    !(suffix_map = count_map_create()) ||
 	    !(leading_replacement_table = table_create_empty()) ||
 	    !(normal_replacement_table = table_create_empty()))
 		goto oom;
 	fprintf(stderr, "Generating map data...\n");
-	res = gen_map_data(wordlist, prefix_tree, suffix_tree,
-			   leading_replacement_table,
+	res = gen_map_data(wordlist, password_file, n_threads, prefix_map,
+			   suffix_map, leading_replacement_table,
 			   normal_replacement_table);
 	if (res < 0)
 		return -1;
 
 	fprintf(stderr, "All recorded:\n");
-	dump_map_data(prefix_tree, suffix_tree, leading_replacement_table,
+	dump_map_data(prefix_map, suffix_map, leading_replacement_table,
 		      normal_replacement_table);
 
 	free(normal_replacement_table);
 	free(leading_replacement_table);
-	avl_destroy_tree(suffix_tree);
-	avl_destroy_tree(prefix_tree);
+	count_map_destroy(suffix_map);
+	count_map_destroy(prefix_map);
 	return 0;
+ usage:
+	fprintf(stderr, "Usage: cat <password data> | %s [-t <threads>] "
+		"<wordlist to compare> > <output file>\n"
+		"       %s [-t <threads>] -p <password file> "
+		"<wordlist to compare> > <output file>\n", argv[0], argv[0]);
+	return -1;
  oom:
 	fprintf(stderr, "%s: Out of memory...\n", __func__);
 	return -1;
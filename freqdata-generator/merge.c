@@ -0,0 +1,374 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#define ALLOC(x, n) (x = malloc((n) * sizeof(*(x))))
+// Rows of a replacement table
+#define TABLE_ROWS 256
+
+
+/* Sections sorted by key, then replacement tables, in file order */
+static const char *const sorted_sections[] = {"prefix", "suffix"};
+static const char *const table_sections[] = {"leading", "normal"};
+
+
+struct frequency_file {
+	const char *path;
+	FILE *fd;
+	char *line;
+	size_t line_size;
+	// Entries of the current section, the offset of the first one and
+	// the number not read yet
+	long n_entries, remaining;
+	off_t entries_offset;
+	// Last entry read, has_key is unset before the first one
+	char *key;
+	size_t key_size;
+	unsigned long long count;
+	int has_key;
+};
+
+
+/* Reads a line without its newline, -1 at the end of the file */
+static long read_line(struct frequency_file *file)
+{
+	ssize_t len = getline(&file->line, &file->line_size, file->fd);
+	if (len < 0) {
+		fprintf(stderr, "%s: Unexpected end of %s...\n", __func__,
+			file->path);
+		return -1;
+	}
+	if (len > 0 && file->line[len-1] == '\n')
+		file->line[--len] = '\0';
+	return len;
+}
+
+
+static int expect_line(struct frequency_file *file, const char *expected)
+{
+	if (read_line(file) < 0)
+		return -1;
+	if (strcmp(file->line, expected)) {
+		fprintf(stderr, "%s: Expected \"%s\" in %s, got \"%s\"...\n",
+			__func__, expected, file->path, file->line);
+		return -1;
+	}
+	return 0;
+}
+
+
+/* Reads ":<name>:" and "START <n>" and remembers where the entries begin */
+static int read_section_header(struct frequency_file *file, const char *name)
+{
+	char tag[64], *end;
+
+	snprintf(tag, sizeof tag, ":%s:", name);
+	if (expect_line(file, tag) < 0 || read_line(file) < 0)
+		return -1;
+	if (strncmp(file->line, "START ", 6) ||
+	    (file->n_entries = strtol(file->line + 6, &end, 10)) < 0 ||
+	    *end != '\0') {
+		fprintf(stderr, "%s: Bad entry count \"%s\" in %s...\n",
+			__func__, file->line, file->path);
+		return -1;
+	}
+	if ((file->entries_offset = ftello(file->fd)) < 0) {
+		fprintf(stderr, "%s: %s is not seekable...\n", __func__,
+			file->path);
+		return -1;
+	}
+	return 0;
+}
+
+
+static int rewind_section(struct frequency_file *file)
+{
+	if (fseeko(file->fd, file->entries_offset, SEEK_SET) < 0) {
+		fprintf(stderr, "%s: Failed to seek in %s...\n", __func__,
+			file->path);
+		return -1;
+	}
+	file->remaining = file->n_entries;
+	file->has_key = 0;
+	return 0;
+}
+
+
+/*
+ * Reads the next ">key" and count of a sorted section, 1 if success, 0 at the
+ * end of the section, -1 otherwise. Keys must be in descending order, the
+ * order the generator writes them in.
+ */
+static int next_entry(struct frequency_file *file)
+{
+	long len;
+	char *end;
+
+	if (file->remaining == 0)
+		return 0;
+	if ((len = read_line(file)) < 0)
+		return -1;
+	if (file->line[0] != '>') {
+		fprintf(stderr, "%s: Corrupt entry \"%s\" in %s...\n", __func__,
+			file->line, file->path);
+		return -1;
+	}
+	if (file->has_key && strcmp(file->line + 1, file->key) >= 0) {
+		fprintf(stderr, "%s: Keys of %s are not sorted at \"%s\"...\n",
+			__func__, file->path, file->line + 1);
+		return -1;
+	}
+	if ((size_t)len > file->key_size) {
+		char *grown = realloc(file->key, len);
+		if (!grown)
+			goto oom;
+		file->key = grown;
+		file->key_size = len;
+	}
+	memcpy(file->key, file->line + 1, len);
+	file->has_key = 1;
+
+	if (read_line(file) < 0)
+		return -1;
+	file->count = strtoull(file->line, &end, 10);
+	if (file->line[0] == '\0' || *end != '\0') {
+		fprintf(stderr, "%s: Bad count \"%s\" in %s...\n", __func__,
+			file->line, file->path);
+		return -1;
+	}
+	file->remaining--;
+	return 1;
+ oom:
+	fprintf(stderr, "%s: Out of memory...\n", __func__);
+	return -1;
+}
+
+
+/* Binary heap of files on their current key, the greatest first */
+static inline int heap_before(struct frequency_file *a,
+			      struct frequency_file *b)
+{
+	return strcmp(a->key, b->key) > 0;
+}
+
+
+static void heap_push(struct frequency_file **heap, int *n_heap,
+		      struct frequency_file *file)
+{
+	int i;
+	for (i=(*n_heap)++; i > 0 && heap_before(file, heap[(i-1)/2]);
+	     i=(i-1)/2)
+		heap[i] = heap[(i-1)/2];
+	heap[i] = file;
+}
+
+
+static struct frequency_file *heap_pop(struct frequency_file **heap,
+				       int *n_heap)
+{
+	struct frequency_file *top = heap[0], *last = heap[--(*n_heap)];
+	int i = 0, child;
+
+	while ((child = 2 * i + 1) < *n_heap) {
+		if (child + 1 < *n_heap && heap_before(heap[child+1],
+						       heap[child]))
+			child++;
+		if (!heap_before(heap[child], last))
+			break;
+		heap[i] = heap[child];
+		i = child;
+	}
+	heap[i] = last;
+	return top;
+}
+
+
+/*
+ * Merges the current sorted section of all files, summing the counts of keys
+ * found in several, and writes the result to out unless it is NULL. Returns
+ * the number of merged entries, -1 on failure.
+ */
+static long merge_sorted_section(struct frequency_file *files, int n_files,
+				 struct frequency_file **heap,
+				 struct frequency_file **equal, FILE *out)
+{
+	int i, res, n_heap = 0;
+	long n_merged = 0;
+
+	for (i=0; i<n_files; i++) {
+		if (rewind_section(&files[i]) < 0 ||
+		    (res = next_entry(&files[i])) < 0)
+			return -1;
+		if (res)
+			heap_push(heap, &n_heap, &files[i]);
+	}
+	while (n_heap > 0) {
+		int n_equal = 0;
+		unsigned long long count = 0;
+
+		do {
+			equal[n_equal] = heap_pop(heap, &n_heap);
+			count += equal[n_equal++]->count;
+		} while (n_heap > 0 && !strcmp(heap[0]->key, equal[0]->key));
+		if (out)
+			fprintf(out, ">%s\n%llu\n", equal[0]->key, count);
+		n_merged++;
+
+		for (i=0; i<n_equal; i++) {
+			if ((res = next_entry(equal[i])) < 0)
+				return -1;
+			if (res)
+				heap_push(heap, &n_heap, equal[i]);
+		}
+	}
+	return n_merged;
+}
+
+
+/*
+ * Sums the rows of the current replacement table of all files. Replacements
+ * keep the order they are first seen in, going through the files in turn,
+ * which is the row the generator would write for the concatenated corpora.
+ */
+static int merge_table_section(struct frequency_file *files, int n_files,
+			       FILE *out)
+{
+	int row, i, j;
+
+	for (row=0; row<TABLE_ROWS; row++) {
+		unsigned long long counts[256] = {0};
+		unsigned char order[256], seen[256] = {0};
+		int n_order = 0;
+
+		for (i=0; i<n_files; i++) {
+			char *text, *end;
+			long n_pairs;
+
+			if (read_line(&files[i]) < 0)
+				return -1;
+			text = files[i].line;
+			n_pairs = strtol(text, &end, 10);
+			if (end == text || n_pairs < 0 || n_pairs > 256)
+				goto corrupt;
+			for (j=0; j<n_pairs; j++) {
+				unsigned long character;
+				unsigned long long frequency;
+				text = end;
+				character = strtoul(text, &end, 10);
+				if (end == text || *end != ':' ||
+				    character > 0xFF)
+					goto corrupt;
+				text = end + 1;
+				frequency = strtoull(text, &end, 10);
+				if (end == text)
+					goto corrupt;
+				if (!seen[character]) {
+					seen[character] = 1;
+					order[n_order++] = character;
+				}
+				counts[character] += frequency;
+			}
+			continue;
+		 corrupt:
+			fprintf(stderr, "%s: Corrupt row %d in %s...\n",
+				__func__, row, files[i].path);
+			return -1;
+		}
+
+		fprintf(out, "%d", n_order);
+		for (j=0; j<n_order; j++)
+			fprintf(out, " %u:%llu", (unsigned int)order[j],
+				counts[order[j]]);
+		fprintf(out, "\n");
+	}
+	return 0;
+}
+
+
+/*
+ * Sums frequency files the generator wrote for parts of a corpus into the file
+ * it would write for the whole. Sorted sections are merged a key at a time,
+ * once to count the entries for the header and once to write them, so memory
+ * use does not depend on the size of the files.
+ */
+int main(int argc, char *argv[])
+{
+	int i, j, n_files = argc - 1, res = -1;
+	struct frequency_file *files = NULL, **heap = NULL, **equal = NULL;
+
+	if (n_files < 1) {
+		fprintf(stderr, "Usage: %s <frequency file>... > <output file>\n",
+			argv[0]);
+		return -1;
+	}
+	if (!(files = calloc(n_files, sizeof *files)) ||
+	    !ALLOC(heap, n_files) || !ALLOC(equal, n_files))
+		goto oom;
+	for (i=0; i<n_files; i++) {
+		files[i].path = argv[i+1];
+		if (!(files[i].fd = fopen(files[i].path, "rb"))) {
+			fprintf(stderr, "%s: Failed to open file %s...\n",
+				__func__, files[i].path);
+			goto out;
+		}
+	}
+
+	for (j=0; j<2; j++) {
+		long n_merged;
+		for (i=0; i<n_files; i++)
+			if (read_section_header(&files[i],
+						sorted_sections[j]) < 0)
+				goto out;
+		if ((n_merged = merge_sorted_section(files, n_files, heap,
+						     equal, NULL)) < 0)
+			goto out;
+		fprintf(stdout, ":%s:\n", sorted_sections[j]);
+		fprintf(stdout, "START %ld\n", n_merged);
+		if (merge_sorted_section(files, n_files, heap, equal,
+					 stdout) < 0)
+			goto out;
+		fprintf(stdout, "END\n");
+		for (i=0; i<n_files; i++)
+			if (expect_line(&files[i], "END") < 0)
+				goto out;
+	}
+
+	for (j=0; j<2; j++) {
+		for (i=0; i<n_files; i++) {
+			if (read_section_header(&files[i],
+						table_sections[j]) < 0)
+				goto out;
+			if (files[i].n_entries != TABLE_ROWS) {
+				fprintf(stderr, "%s: %s has %ld rows in its "
+					"%s table...\n", __func__,
+					files[i].path, files[i].n_entries,
+					table_sections[j]);
+				goto out;
+			}
+		}
+		fprintf(stdout, ":%s:\n", table_sections[j]);
+		fprintf(stdout, "START %d\n", TABLE_ROWS);
+		if (merge_table_section(files, n_files, stdout) < 0)
+			goto out;
+		fprintf(stdout, "END\n");
+		for (i=0; i<n_files; i++)
+			if (expect_line(&files[i], "END") < 0)
+				goto out;
+	}
+	res = fflush(stdout) ? -1 : 0;
+	goto out;
+ oom:
+	fprintf(stderr, "%s: Out of memory...\n", __func__);
+ out:
+	for (i=0; files && i<n_files; i++) {
+		if (files[i].fd)
+			fclose(files[i].fd);
+		free(files[i].line);
+		free(files[i].key);
+	}
+	free(files);
+	free(heap);
+	free(equal);
+	return res;
+}
@@ -0,0 +1,152 @@
+#include <math.h>
+#include <stdio.h>
+#include <vector>
+#include "event_iterator.hpp"
+
+// Most bands a single event may spread over
+#define BAND_MAX_LEVELS (1 << 20)
+
+
+using namespace std;
+
+
+/*
+ * The cost of an outcome is its log-probability drop from the likeliest
+ * outcome of its event, quantized to a level of floor(cost / band_width).
+ * The levels of an outcome list add up to its band, and a list in band L
+ * costs between L and L + n_events band widths. Bands are enumerated in
+ * ascending order with a depth first search over the events, so besides
+ * per-event tables of level boundaries the state is one level and index per
+ * event.
+ */
+struct band_search {
+	const event_list *list;
+	double band_width, max_cost;
+	// level_starts[i][l] is the first outcome of event i with level l or
+	// more, the outcomes of level l end at level_starts[i][l+1]
+	vector<vector<size_t>> level_starts;
+	// Largest level sum of events i and on
+	vector<int> suffix_max;
+	vector<int> outcome_identifiers;
+	iterator_cb_t iterator_cb;
+	void *cb_data;
+	unsigned long long n_emitted;
+	bool stopped;
+};
+
+
+static bool build_levels(struct band_search *search)
+{
+	const event_list *list = search->list;
+	int n_events = list->n_events;
+
+	search->level_starts.resize(n_events);
+	search->suffix_max.assign(n_events + 1, 0);
+	for (int i=0; i<n_events; i++) {
+		const outcome_span& event = list->events[i];
+		double best = event[0].logarithmic_probability;
+		vector<size_t>& starts = search->level_starts[i];
+		size_t n_possible = event.size();
+		for (size_t j=0; j<event.size(); j++) {
+			double cost = best - event[j].logarithmic_probability;
+			double level = floor(cost / search->band_width);
+			if (isinf(cost)) {
+				// Outcomes that can never occur are left out
+				n_possible = j;
+				break;
+			}
+			if (!(level < BAND_MAX_LEVELS)) {
+				fprintf(stderr, "Error in %s: Band width too "
+					"small...\n", __func__);
+				return false;
+			}
+			while (starts.size() <= (size_t)level)
+				starts.push_back(j);
+		}
+		if (n_possible == 0)
+			return false;
+		starts.push_back(n_possible);
+	}
+	for (int i=n_events-1; i>=0; i--)
+		search->suffix_max[i] = search->suffix_max[i+1] +
+					(int)search->level_starts[i].size() - 2;
+	return true;
+}
+
+
+/* Emits the lists whose events i and on have a level sum of remaining */
+static void search_band(struct band_search *search, int i, int remaining,
+			double logprob, double cost_left)
+{
+	const event_list *list = search->list;
+	const outcome_span& event = list->events[i];
+	const vector<size_t>& starts = search->level_starts[i];
+	int max_level = starts.size() - 2;
+	int first_level = remaining - search->suffix_max[i+1];
+
+	if (first_level < 0)
+		first_level = 0;
+	if (max_level > remaining)
+		max_level = remaining;
+	for (int level=first_level; level<=max_level; level++) {
+		for (size_t j=starts[level]; j<starts[level+1]; j++) {
+			const outcome& o = event[j];
+			double next_logprob = logprob +
+					      o.logarithmic_probability;
+			double next_cost = cost_left - (event[0].
+				logarithmic_probability -
+				o.logarithmic_probability);
+			if (next_cost < 0)
+				// Outcomes only get costlier within an event
+				return;
+			search->outcome_identifiers[i] = o.identifier;
+			if (i < list->n_events - 1) {
+				search_band(search, i + 1, remaining - level,
+					    next_logprob, next_cost);
+			} else if (!search->iterator_cb(
+					search->outcome_identifiers,
+					next_logprob, search->cb_data) ||
+				   ++search->n_emitted ==
+				   list->max_candidates) {
+				search->stopped = true;
+			}
+			if (search->stopped)
+				return;
+		}
+	}
+}
+
+
+void event_list::iterate_banded(iterator_cb_t iterator_cb, void *cb_data,
+				double band_width)
+{
+	struct band_search search;
+	double best_logprob = 0.0;
+
+	if (n_events == 0)
+		return;
+	for (int i=0; i<n_events; i++) {
+		if (events[i].empty())
+			return;
+		best_logprob += events[i][0].logarithmic_probability;
+	}
+	search.list = this;
+	search.band_width = band_width;
+	search.max_cost = best_logprob - min_logprob;
+	search.outcome_identifiers.resize(n_events);
+	search.iterator_cb = iterator_cb;
+	search.cb_data = cb_data;
+	search.n_emitted = 0;
+	search.stopped = false;
+	if (!build_levels(&search))
+		return;
+
+	// Every list of band L costs at least L band widths
+	for (int band=0; band<=search.suffix_max[0]; band++) {
+		if (band * band_width > search.max_cost)
+			break;
+		search_band(&search, 0, band, 0.0, search.max_cost);
+		if (search.stopped)
+			break;
+	}
+}
@@ -0,0 +1,387 @@
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <malloc.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "event_iterator.hpp"
+#include "output_writer.hpp"
+
+// Frequency of the likeliest outcome, the others follow a Zipf law
+#define BENCHMARK_TOP_FREQUENCY 1000000000.0
+
+
+using namespace std;
+
+
+/*
+ * Every allocation of the process goes through these, so the numbers include
+ * the standard library and the slab pools alike.
+ */
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t n, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void *__libc_memalign(size_t alignment, size_t size);
+void __libc_free(void *ptr);
+}
+
+static atomic<unsigned long long> n_allocations(0);
+static atomic<size_t> heap_live(0), heap_peak(0);
+
+
+static inline void *count_allocation(void *ptr)
+{
+	size_t live;
+	if (!ptr)
+		return ptr;
+	n_allocations++;
+	live = heap_live += malloc_usable_size(ptr);
+	for (size_t peak = heap_peak; live > peak &&
+	     !heap_peak.compare_exchange_weak(peak, live); )
+		;
+	return ptr;
+}
+
+
+static inline void count_free(void *ptr)
+{
+	if (ptr)
+		heap_live -= malloc_usable_size(ptr);
+}
+
+
+extern "C" {
+void *malloc(size_t size)
+{
+	return count_allocation(__libc_malloc(size));
+}
+
+
+void *calloc(size_t n, size_t size)
+{
+	return count_allocation(__libc_calloc(n, size));
+}
+
+
+void *realloc(void *ptr, size_t size)
+{
+	count_free(ptr);
+	return count_allocation(__libc_realloc(ptr, size));
+}
+
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+	return count_allocation(__libc_memalign(alignment, size));
+}
+
+
+void *memalign(size_t alignment, size_t size)
+{
+	return count_allocation(__libc_memalign(alignment, size));
+}
+
+
+int posix_memalign(void **ptr, size_t alignment, size_t size)
+{
+	*ptr = count_allocation(__libc_memalign(alignment, size));
+	return *ptr ? 0 : ENOMEM;
+}
+
+
+void free(void *ptr)
+{
+	count_free(ptr);
+	__libc_free(ptr);
+}
+}
+
+
+struct benchmark_config {
+	int seed_length;
+	int char_outcomes, affix_outcomes;
+	double skew;
+	unsigned long long n_candidates;
+	int n_threads;
+	double band_width;
+};
+
+
+// Rendering tables of the synthetic model, for the output benchmark
+struct synthetic_model {
+	vector<string> affixes;
+	string characters;
+	string seed;
+	int n_events;
+	candidate_writer *writer;
+	unsigned long long n_emitted;
+};
+
+
+static vector<unsigned long long> zipf_frequencies(int n_outcomes, double skew)
+{
+	vector<unsigned long long> freqs;
+	for (int k=0; k<n_outcomes; k++) {
+		double freq = BENCHMARK_TOP_FREQUENCY / pow(k + 1, skew);
+		freqs.push_back(freq < 1.0 ? 1 : (unsigned long long)freq);
+	}
+	return freqs;
+}
+
+
+static event_list *build_synthetic_list(const struct benchmark_config *config)
+{
+	int n_events = config->seed_length + 2;
+	event_list *list = new event_list(n_events);
+	vector<int> identifiers;
+
+	for (int i=0; i<n_events; i++) {
+		bool affix = i == 0 || i == n_events - 1;
+		int n_outcomes = affix ? config->affix_outcomes
+				       : config->char_outcomes;
+		identifiers.clear();
+		for (int j=0; j<n_outcomes; j++)
+			identifiers.push_back(j);
+		list->set_event_sample_space(i, identifiers,
+					     zipf_frequencies(n_outcomes,
+							      config->skew));
+	}
+	list->set_limits(config->n_candidates, -INFINITY);
+	return list;
+}
+
+
+static bool count_cb(const vector<int>&, double, void *cb_data)
+{
+	(*(unsigned long long*)cb_data)++;
+	return true;
+}
+
+
+static bool output_cb(const vector<int>& outcomes, double logprob,
+		      void *cb_data)
+{
+	struct synthetic_model *model = (struct synthetic_model*)cb_data;
+	const string& prefix = model->affixes[outcomes[0]];
+	const string& suffix = model->affixes[outcomes[model->n_events-1]];
+	for (int i=1; i<model->n_events-1; i++)
+		model->seed[i-1] = model->characters[outcomes[i]];
+
+	const char *parts[] = {prefix.data(), model->seed.data(),
+			       suffix.data()};
+	const size_t lens[] = {prefix.size(), model->seed.size(),
+			       suffix.size()};
+	model->n_emitted++;
+	return model->writer->write_candidate(parts, lens, 3, logprob);
+}
+
+
+/* Peak resident set size in KiB, reset by reset_peak_rss() where supported */
+static unsigned long peak_rss(void)
+{
+	string line;
+	ifstream status("/proc/self/status");
+	while (getline(status, line))
+		if (!line.compare(0, 6, "VmHWM:"))
+			return strtoul(line.c_str() + 6, NULL, 10);
+	return 0;
+}
+
+
+static void reset_peak_rss(void)
+{
+	int fd = open("/proc/self/clear_refs", O_WRONLY);
+	if (fd < 0)
+		return;
+	if (write(fd, "5", 1) < 0)
+		cerr << "Peak RSS covers the whole process\n";
+	close(fd);
+}
+
+
+static void run_case(const char *name, const struct benchmark_config *config,
+		     void (*run)(const struct benchmark_config*,
+				 unsigned long long&))
+{
+	typedef chrono::steady_clock clock;
+	unsigned long long n_emitted = 0, allocations;
+	size_t heap_base;
+	clock::time_point start;
+	double seconds;
+
+	reset_peak_rss();
+	heap_base = heap_live;
+	heap_peak = heap_base;
+	allocations = n_allocations;
+	start = clock::now();
+	run(config, n_emitted);
+	seconds = chrono::duration<double>(clock::now() - start).count();
+	allocations = n_allocations - allocations;
+
+	printf("%-10s %12llu %9.3f %12.0f %10.2f %10.2f %10.4f\n", name,
+	       n_emitted, seconds, n_emitted / seconds,
+	       (heap_peak - heap_base) / 1048576.0, peak_rss() / 1024.0,
+	       n_emitted ? (double)allocations / n_emitted : 0.0);
+	fflush(stdout);
+}
+
+
+static void run_sorted(const struct benchmark_config *config,
+		       unsigned long long& n_emitted)
+{
+	event_list *list = build_synthetic_list(config);
+	list->iterate_sorted(count_cb, &n_emitted);
+	delete list;
+}
+
+
+static void run_parallel(const struct benchmark_config *config,
+			 unsigned long long& n_emitted)
+{
+	event_list *list = build_synthetic_list(config);
+	list->iterate_sorted_parallel(count_cb, &n_emitted, config->n_threads);
+	delete list;
+}
+
+
+static void run_banded(const struct benchmark_config *config,
+		       unsigned long long& n_emitted)
+{
+	event_list *list = build_synthetic_list(config);
+	list->iterate_banded(count_cb, &n_emitted, config->band_width);
+	delete list;
+}
+
+
+static void run_output(const struct benchmark_config *config,
+		       unsigned long long& n_emitted)
+{
+	event_list *list = build_synthetic_list(config);
+	struct synthetic_model model;
+	int fd = open("/dev/null", O_WRONLY);
+	candidate_writer writer(fd, DELIMIT_NEWLINE, false);
+
+	for (int i=0; i<config->affix_outcomes; i++)
+		model.affixes.push_back(to_string(i));
+	for (int i=0; i<config->char_outcomes; i++)
+		model.characters.push_back((char)(' ' + i % 95));
+	model.seed.assign(config->seed_length, ' ');
+	model.n_events = list->n_events;
+	model.writer = &writer;
+	model.n_emitted = 0;
+	list->iterate_sorted(output_cb, &model);
+	writer.flush();
+	n_emitted = model.n_emitted;
+	close(fd);
+	delete list;
+}
+
+
+static void print_usage(char *name)
+{
+	cerr << "Usage: " << name << " [options]\n"
+	     << "Options:\n"
+	     << "  -L, --seed-length <N>    Characters per seed (default 8)\n"
+	     << "  -o, --outcomes <N>       Outcomes per character event "
+	     << "(default 16, at most 256)\n"
+	     << "  -a, --affixes <N>        Outcomes of the prefix and suffix "
+	     << "events (default 1000)\n"
+	     << "  -s, --skew <S>           Zipf exponent of the outcome "
+	     << "frequencies (default 1)\n"
+	     << "  -n, --candidates <N>     Candidates per case (default "
+	     << "1000000)\n"
+	     << "  -t, --threads <N>        Threads of the parallel case "
+	     << "(default 4)\n"
+	     << "  -w, --band-width <W>     Band width of the banded case "
+	     << "(default 0.5)\n";
+}
+
+
+/*
+ * Enumerates a synthetic event list with iterate_sorted, the threaded and
+ * banded engines and the rendering and output path, printing throughput and
+ * memory use of every case.
+ */
+int main(int argc, char *argv[])
+{
+	int opt;
+	char *end;
+	struct benchmark_config config = {
+		.seed_length = 8,
+		.char_outcomes = 16,
+		.affix_outcomes = 1000,
+		.skew = 1.0,
+		.n_candidates = 1000000,
+		.n_threads = 4,
+		.band_width = 0.5,
+	};
+	static const struct option long_options[] = {
+		{"seed-length", required_argument, NULL, 'L'},
+		{"outcomes", required_argument, NULL, 'o'},
+		{"affixes", required_argument, NULL, 'a'},
+		{"skew", required_argument, NULL, 's'},
+		{"candidates", required_argument, NULL, 'n'},
+		{"threads", required_argument, NULL, 't'},
+		{"band-width", required_argument, NULL, 'w'},
+		{NULL, 0, NULL, 0},
+	};
+
+	while ((opt = getopt_long(argc, argv, "L:o:a:s:n:t:w:", long_options,
+				  NULL)) != -1) {
+		switch (opt) {
+		case 'L':
+			config.seed_length = strtol(optarg, &end, 10);
+			break;
+		case 'o':
+			config.char_outcomes = strtol(optarg, &end, 10);
+			break;
+		case 'a':
+			config.affix_outcomes = strtol(optarg, &end, 10);
+			break;
+		case 's':
+			config.skew = strtod(optarg, &end);
+			break;
+		case 'n':
+			config.n_candidates = strtoull(optarg, &end, 10);
+			break;
+		case 't':
+			config.n_threads = strtol(optarg, &end, 10);
+			break;
+		case 'w':
+			config.band_width = strtod(optarg, &end);
+			break;
+		default:
+			print_usage(argv[0]);
+			return -1;
+		}
+		if (*optarg == '\0' || *end != '\0') {
+			cerr << "Invalid argument \"" << optarg << "\"\n";
+			return -1;
+		}
+	}
+	if (optind != argc || config.seed_length < 1 ||
+	    config.char_outcomes < 1 || config.char_outcomes > 256 ||
+	    config.affix_outcomes < 1 || config.n_candidates < 1 ||
+	    config.n_threads < 1 || !(config.band_width > 0)) {
+		print_usage(argv[0]);
+		return -1;
+	}
+
+	printf("%-10s %12s %9s %12s %10s %10s %10s\n", "case", "candidates",
+	       "seconds", "cand/s", "heap MiB", "RSS MiB", "allocs/c");
+	run_case("sorted", &config, run_sorted);
+	run_case("parallel", &config, run_parallel);
+	run_case("banded", &config, run_banded);
+	run_case("output", &config, run_output);
+	return 0;
+}
@@ -1,10 +1,15 @@
 #ifndef ACYCLIC_ITERABLE
 #define ACYCLIC_ITERABLE
 
+#include <math.h>
 #include <iostream>
 #include <vector>
+#include <algorithm>
 #include <queue>
 #include <set>
+#include <memory>
+#include <utility>
+#include "slab_pool.hpp"
 
 
 using namespace std;
@@ -14,9 +19,8 @@ template <class T>
 struct node_cost {
 	double total_cost;
 	T* destination_node;
-	// A depth count can be used to avoid redundant visits in the iteration
-	// if edge composition is commutative. This can speed up iterations on
-	// e.g. a 'manhattan' graph.
+	// Number of edges from the start node. Breaks ties between equal cost
+	// nodes in favour of the shallower one.
 	unsigned long long depth;
 	inline bool operator <(const node_cost& rhs) const
 	{
@@ -48,80 +52,285 @@ struct node_cost {
 	}
 };
 
-/* NOTE: Strict weak ordering of T required for set implementation */
+/* Priority queue exposing its container so the frontier can be trimmed */
 template <class T>
+class frontier_queue
+	: public priority_queue<node_cost<T>, vector<node_cost<T>>,
+				greater<node_cost<T>>> {
+	public:
+	inline vector<node_cost<T>>& container(void)
+	{
+		return this->c;
+	}
+	inline const vector<node_cost<T>>& container(void) const
+	{
+		return this->c;
+	}
+	inline void reheap(void)
+	{
+		make_heap(this->c.begin(), this->c.end(), this->comp);
+	}
+};
+
+
+/* Work done by a dijkstra_iterator so far, for progress reports */
+struct dijkstra_stats {
+	unsigned long long nodes_expanded;
+	// Successors of expanded nodes, and those of them dropped because they
+	// were already enqueued or cost more than the limit
+	unsigned long long successors_generated, successors_deduplicated;
+	unsigned long long successors_pruned;
+	// Frontier nodes dropped by trimming
+	unsigned long long nodes_trimmed;
+	// Frontier heap size now and at its largest, and enqueued set size
+	unsigned long long frontier_size, frontier_peak, enqueued_size;
+};
+
+
+/*
+ * NOTE: Strict weak ordering of T required for set implementation
+ *
+ * The graph is described by two callables, which can be plain functions or
+ * closures carrying their own state, so several graphs can be iterated at
+ * once and the compiler is free to inline them into the iteration loop:
+ *
+ *   void expand(const T& node, vector<T>& children);
+ *   double edge_cost(const T& from, const T& to);
+ *
+ * The expander appends successors to a buffer owned by the iterator and nodes
+ * are allocated through Allocator (by default from slab pools owned by the
+ * iterator), so after the pools warm up an iteration step does not allocate.
+ *
+ * By default nodes reachable over several paths are deduplicated through a set
+ * of the enqueued nodes. An expander that generates every node from exactly
+ * one parent can turn deduplication off, in which case the set is unused.
+ *
+ * Iteration can be bounded by a maximum total cost and/or a maximum number of
+ * visited nodes. Successors above the cost bound are never enqueued, and with
+ * a node bound the frontier is periodically cut down to the nodes that can
+ * still be visited within the remaining budget.
+ */
+template <class T, class Expander = void (*)(const T&, vector<T>&),
+	  class EdgeCost = double (*)(const T&, const T&),
+	  class Allocator = pool_allocator<T>>
 class dag_implicit {
-	typedef vector<T> (*expander_t)(T*);
-	typedef double (*edge_cost_t)(T*,T*);
 	private:
-	T *start_node;
-	expander_t expand;
-	edge_cost_t edge_cost;
+	T start_node;
+	bool has_start;
+	Expander expand;
+	EdgeCost edge_cost;
+	bool deduplicate;
+	unsigned long long max_nodes;
+	double max_cost;
 	public:
 	class dijkstra_iterator {
 		private:
-		set<T> nodes_enqueued;
-		expander_t expand;
-		edge_cost_t edge_cost;
-		priority_queue<node_cost<T>, vector<node_cost<T>>,
-			       greater<node_cost<T>>> dijkstra_q;
+		typedef allocator_traits<Allocator> alloc_traits;
+		// Before the set, which is constructed with a copy of it
+		Allocator node_alloc;
+		set<T, less<T>, Allocator> nodes_enqueued;
+		vector<T> children;
+		Expander expand;
+		EdgeCost edge_cost;
+		bool deduplicate;
+		// Nodes left to visit if node_limited, including the top node
+		bool node_limited;
+		unsigned long long nodes_remaining;
+		double cost_limit;
+		frontier_queue<T> dijkstra_q;
+		struct dijkstra_stats counters;
+		template <class U>
+		T *acquire_node(U&& node);
+		void release_node(T *node);
+		void clear_frontier(void);
+		void trim_frontier(void);
 		public:
+		dijkstra_iterator(const Expander& expand,
+				  const EdgeCost& edge_cost,
+				  bool deduplicate);
+		dijkstra_iterator(dijkstra_iterator&&) = default;
+		dijkstra_iterator& operator =(dijkstra_iterator&&) = default;
 		void operator ++();
 		const T& operator *();
 		bool operator ==(const dijkstra_iterator& rhs);
 		bool operator !=(const dijkstra_iterator& rhs);
-		void set_start(T start_node);
-		void set_graph(expander_t, edge_cost_t);
+		void set_start(const T& start_node);
+		void set_start(T&& start_node);
+		void set_limits(unsigned long long max_nodes, double max_cost);
 		bool complete(void) const;
+		void get_stats(struct dijkstra_stats& stats) const;
+		// Checkpointing: the frontier in heap order and the limits left
+		// are all it takes to rebuild an iterator that continues
+		// exactly like this one
+		inline const vector<node_cost<T>>& frontier(void) const
+		{
+			return dijkstra_q.container();
+		}
+		void get_limits(unsigned long long& max_nodes,
+				double& max_cost) const;
+		// Empties the frontier ahead of restore_node() and sets the
+		// limits left
+		void restore_limits(unsigned long long max_nodes,
+				    double max_cost);
+		// Appends a saved frontier node, nodes must be restored in the
+		// order frontier() listed them
+		void restore_node(T&& node, double total_cost,
+				  unsigned long long depth);
+		~dijkstra_iterator(void);
 	};
-	dag_implicit(expander_t, edge_cost_t);
-	void set_start(T start_node);
+	dag_implicit(Expander expand, EdgeCost edge_cost,
+		     bool deduplicate = true);
+	void set_start(const T& start_node);
+	void set_start(T&& start_node);
+	/* A max_nodes of 0 leaves the number of visited nodes unbounded */
+	void set_limits(unsigned long long max_nodes, double max_cost);
 	inline dijkstra_iterator begin(void)
 	{
-		dijkstra_iterator iterator;
-		iterator.set_graph(expand, edge_cost);
-		iterator.set_start(*start_node);
+		dijkstra_iterator iterator(expand, edge_cost, deduplicate);
+		iterator.set_limits(max_nodes, max_cost);
+		if (has_start)
+			iterator.set_start(start_node);
 		return iterator;
 	}
 	inline dijkstra_iterator end(void)
 	{
-		dijkstra_iterator empty_iterator;
+		dijkstra_iterator empty_iterator(expand, edge_cost,
+						 deduplicate);
 		return empty_iterator;
 	}
-	~dag_implicit(void);
 };
 
 
-template <class T>
-dag_implicit<T>::dag_implicit(expander_t expand, edge_cost_t edge_cost)
+template <class T, class Expander, class EdgeCost, class Allocator>
+dag_implicit<T, Expander, EdgeCost, Allocator>::dag_implicit(
+	Expander expand, EdgeCost edge_cost, bool deduplicate)
+	: expand(move(expand)), edge_cost(move(edge_cost))
 {
-	this->start_node = NULL;
-	this->expand = expand;
-	this->edge_cost = edge_cost;
+	this->has_start = false;
+	this->deduplicate = deduplicate;
+	this->max_nodes = 0;
+	this->max_cost = INFINITY;
 }
 
 
-template <class T>
+template <class T, class Expander, class EdgeCost, class Allocator>
 void
-dag_implicit<T>::set_start(T start_node)
+dag_implicit<T, Expander, EdgeCost, Allocator>::set_limits(
+	unsigned long long max_nodes, double max_cost)
 {
-	if (this->start_node)
-		delete this->start_node;
-	this->start_node = new T(start_node);
+	this->max_nodes = max_nodes;
+	this->max_cost = max_cost;
 }
 
 
-template <class T>
-dag_implicit<T>::~dag_implicit(void)
+template <class T, class Expander, class EdgeCost, class Allocator>
+void
+dag_implicit<T, Expander, EdgeCost, Allocator>::set_start(
+	const T& start_node)
 {
-	if (this->start_node)
-		delete this->start_node;
+	this->start_node = start_node;
+	this->has_start = true;
 }
 
 
-template <class T>
+template <class T, class Expander, class EdgeCost, class Allocator>
 void
-dag_implicit<T>::dijkstra_iterator::operator ++()
+dag_implicit<T, Expander, EdgeCost, Allocator>::set_start(T&& start_node)
+{
+	this->start_node = move(start_node);
+	this->has_start = true;
+}
+
+
+template <class T, class Expander, class EdgeCost, class Allocator>
+dag_implicit<T, Expander, EdgeCost, Allocator>::dijkstra_iterator::
+dijkstra_iterator(const Expander& expand, const EdgeCost& edge_cost,
+		  bool deduplicate)
+	: nodes_enqueued(less<T>(), node_alloc), expand(expand),
+	  edge_cost(edge_cost)
+{
+	this->deduplicate = deduplicate;
+	this->node_limited = false;
+	this->nodes_remaining = 0;
+	this->cost_limit = INFINITY;
+	this->counters = (struct dijkstra_stats){};
+}
+
+
+template <class T, class Expander, class EdgeCost, class Allocator>
+template <class U>
+T *
+dag_implicit<T, Expander, EdgeCost, Allocator>::dijkstra_iterator::
+acquire_node(U&& node)
+{
+	T *new_node = alloc_traits::allocate(node_alloc, 1);
+	alloc_traits::construct(node_alloc, new_node, forward<U>(node));
+	return new_node;
+}
+
+
+template <class T, class Expander, class EdgeCost, class Allocator>
+void
+dag_implicit<T, Expander, EdgeCost, Allocator>::dijkstra_iterator::
+release_node(T *node)
+{
+	alloc_traits::destroy(node_alloc, node);
+	alloc_traits::deallocate(node_alloc, node, 1);
+}
+
+
+template <class T, class Expander, class EdgeCost, class Allocator>
+void
+dag_implicit<T, Expander, EdgeCost, Allocator>::dijkstra_iterator::
+clear_frontier(void)
+{
+	// No need to keep the heap order of nodes that are all dropped
+	for (node_cost<T>& nc : dijkstra_q.container())
+		release_node(nc.destination_node);
+	dijkstra_q.container().clear();
+	nodes_enqueued.clear();
+}
+
+
+/*
+ * Only the nodes_remaining cheapest nodes of the frontier (and their equal
+ * cost peers) can still be visited: every other node, and every descendant of
+ * one, sorts after them. Drop the rest and lower the cost limit to the most
+ * expensive survivor so they are not enqueued again later.
+ */
+template <class T, class Expander, class EdgeCost, class Allocator>
+void
+dag_implicit<T, Expander, EdgeCost, Allocator>::dijkstra_iterator::
+trim_frontier(void)
+{
+	vector<node_cost<T>>& frontier = dijkstra_q.container();
+	typename vector<node_cost<T>>::iterator nth, first_dropped;
+	double cutoff;
+
+	nth = frontier.begin() + (nodes_remaining - 1);
+	nth_element(frontier.begin(), nth, frontier.end());
+	cutoff = nth->total_cost;
+	first_dropped = partition(nth + 1, frontier.end(),
+				  [cutoff](const node_cost<T>& nc) {
+					  return nc.total_cost <= cutoff;
+				  });
+	for (auto it = first_dropped; it != frontier.end(); it++) {
+		if (deduplicate)
+			nodes_enqueued.erase(*it->destination_node);
+		release_node(it->destination_node);
+		counters.nodes_trimmed++;
+	}
+	frontier.erase(first_dropped, frontier.end());
+	dijkstra_q.reheap();
+	if (cutoff < cost_limit)
+		cost_limit = cutoff;
+}
+
+
+template <class T, class Expander, class EdgeCost, class Allocator>
+void
+dag_implicit<T, Expander, EdgeCost, Allocator>::dijkstra_iterator::
+operator ++()
 {
 	if (dijkstra_q.empty())
 		return;
@@ -129,85 +338,181 @@ dag_implicit<T>::dijkstra_iterator::operator ++()
 	double total_cost = nc.total_cost;
 	T* max_node = nc.destination_node;
 	unsigned long long depth = nc.depth;
-	const vector<T>& children = expand(max_node);
 
+	children.clear();
+	expand(*max_node, children);
 	dijkstra_q.pop();
-	nodes_enqueued.erase(*max_node);
-	for (const T& child : children) {
-		T* next;
-		if (nodes_enqueued.find(child) != nodes_enqueued.end())
+	if (deduplicate)
+		nodes_enqueued.erase(*max_node);
+	counters.nodes_expanded++;
+	counters.successors_generated += children.size();
+	for (T& child : children) {
+		double next_total_cost;
+		if (deduplicate &&
+		    nodes_enqueued.find(child) != nodes_enqueued.end()) {
+			counters.successors_deduplicated++;
+			continue;
+		}
+		next_total_cost = total_cost + edge_cost(*max_node, child);
+		if (next_total_cost > cost_limit) {
+			counters.successors_pruned++;
 			continue;
-		next = new T(child);
+		}
+		if (deduplicate)
+			nodes_enqueued.insert(child);
 		node_cost<T> next_cost = (node_cost<T>){
-			.total_cost = total_cost + edge_cost(max_node, next),
-			.destination_node = next,
+			.total_cost = next_total_cost,
+			.destination_node = acquire_node(move(child)),
 			.depth = depth + 1,
 		};
 		dijkstra_q.push(next_cost);
-		nodes_enqueued.insert(child);
 	}
-	delete max_node;
+	release_node(max_node);
+	if (dijkstra_q.size() > counters.frontier_peak)
+		counters.frontier_peak = dijkstra_q.size();
+
+	if (!node_limited)
+		return;
+	if (--nodes_remaining == 0)
+		clear_frontier();
+	else if (dijkstra_q.size() > 2 * nodes_remaining)
+		trim_frontier();
 }
 
 
-template <class T>
+template <class T, class Expander, class EdgeCost, class Allocator>
 const T&
-dag_implicit<T>::dijkstra_iterator::operator *()
+dag_implicit<T, Expander, EdgeCost, Allocator>::dijkstra_iterator::
+operator *()
 {
 	return *(dijkstra_q.top().destination_node);
 }
 
 
-template <class T>
+template <class T, class Expander, class EdgeCost, class Allocator>
 bool
-dag_implicit<T>::dijkstra_iterator::operator ==(const dijkstra_iterator& x)
+dag_implicit<T, Expander, EdgeCost, Allocator>::dijkstra_iterator::
+operator ==(const dijkstra_iterator& x)
 {
 	return dijkstra_q.empty() && x.complete();
 }
 
 
-template <class T>
+template <class T, class Expander, class EdgeCost, class Allocator>
 bool
-dag_implicit<T>::dijkstra_iterator::operator !=(const dijkstra_iterator& x)
+dag_implicit<T, Expander, EdgeCost, Allocator>::dijkstra_iterator::
+operator !=(const dijkstra_iterator& x)
 {
 	return !dijkstra_q.empty() || !x.complete();
 }
 
 
-template <class T>
+template <class T, class Expander, class EdgeCost, class Allocator>
 void
-dag_implicit<T>::dijkstra_iterator::set_start(T start_node)
+dag_implicit<T, Expander, EdgeCost, Allocator>::dijkstra_iterator::
+set_start(const T& start_node)
 {
-	T* first_node;
+	set_start(T(start_node));
+}
 
-	while (!dijkstra_q.empty())
-		dijkstra_q.pop();
-	nodes_enqueued.clear();
 
-	first_node = new T(start_node);
+template <class T, class Expander, class EdgeCost, class Allocator>
+void
+dag_implicit<T, Expander, EdgeCost, Allocator>::dijkstra_iterator::
+set_start(T&& start_node)
+{
+	clear_frontier();
+	if (cost_limit < 0 || (node_limited && nodes_remaining == 0))
+		return;
+
+	if (deduplicate)
+		nodes_enqueued.insert(start_node);
 	dijkstra_q.push((node_cost<T>){
 		.total_cost = 0,
-		.destination_node = first_node,
+		.destination_node = acquire_node(move(start_node)),
 		.depth = 0,
 	});
-	nodes_enqueued.insert(start_node);
+	if (counters.frontier_peak == 0)
+		counters.frontier_peak = 1;
 }
 
 
-template <class T>
+template <class T, class Expander, class EdgeCost, class Allocator>
 void
-dag_implicit<T>::dijkstra_iterator::set_graph(expander_t expand,
-						  edge_cost_t edge_cost)
+dag_implicit<T, Expander, EdgeCost, Allocator>::dijkstra_iterator::
+set_limits(unsigned long long max_nodes, double max_cost)
 {
-	this->expand = expand;
-	this->edge_cost = edge_cost;
+	this->node_limited = max_nodes != 0;
+	this->nodes_remaining = max_nodes;
+	this->cost_limit = max_cost;
 }
 
 
-template <class T>
+template <class T, class Expander, class EdgeCost, class Allocator>
+void
+dag_implicit<T, Expander, EdgeCost, Allocator>::dijkstra_iterator::
+get_limits(unsigned long long& max_nodes, double& max_cost) const
+{
+	max_nodes = node_limited ? nodes_remaining : 0;
+	max_cost = cost_limit;
+}
+
+
+template <class T, class Expander, class EdgeCost, class Allocator>
+void
+dag_implicit<T, Expander, EdgeCost, Allocator>::dijkstra_iterator::
+restore_limits(unsigned long long max_nodes, double max_cost)
+{
+	clear_frontier();
+	set_limits(max_nodes, max_cost);
+}
+
+
+/*
+ * Equal cost nodes pop in an order that depends on the layout of the heap, so
+ * the saved layout is taken over as is rather than heapified again.
+ */
+template <class T, class Expander, class EdgeCost, class Allocator>
+void
+dag_implicit<T, Expander, EdgeCost, Allocator>::dijkstra_iterator::
+restore_node(T&& node, double total_cost, unsigned long long depth)
+{
+	if (deduplicate)
+		nodes_enqueued.insert(node);
+	dijkstra_q.container().push_back((node_cost<T>){
+		.total_cost = total_cost,
+		.destination_node = acquire_node(move(node)),
+		.depth = depth,
+	});
+	if (dijkstra_q.size() > counters.frontier_peak)
+		counters.frontier_peak = dijkstra_q.size();
+}
+
+
+template <class T, class Expander, class EdgeCost, class Allocator>
 bool
-dag_implicit<T>::dijkstra_iterator::complete(void) const
+dag_implicit<T, Expander, EdgeCost, Allocator>::dijkstra_iterator::
+complete(void) const
 {
 	return dijkstra_q.empty();
 }
+
+
+template <class T, class Expander, class EdgeCost, class Allocator>
+void
+dag_implicit<T, Expander, EdgeCost, Allocator>::dijkstra_iterator::
+get_stats(struct dijkstra_stats& stats) const
+{
+	stats = counters;
+	stats.frontier_size = dijkstra_q.size();
+	stats.enqueued_size = nodes_enqueued.size();
+}
+
+
+template <class T, class Expander, class EdgeCost, class Allocator>
+dag_implicit<T, Expander, EdgeCost, Allocator>::dijkstra_iterator::
+~dijkstra_iterator(void)
+{
+	clear_frontier();
+}
 #endif /* ACYCLIC_ITERABLE */
@@ -0,0 +1,204 @@
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <algorithm>
+#include <iostream>
+#include "dedupe.hpp"
+
+#define DEDUPE_INITIAL_SLOTS 1024
+#define DEDUPE_BLOCK_WORDS 8
+
+
+using namespace std;
+
+
+static inline uint64_t mix_hash(uint64_t x)
+{
+	x ^= x >> 30;
+	x *= 0xbf58476d1ce4e5b9ULL;
+	x ^= x >> 27;
+	x *= 0x94d049bb133111ebULL;
+	return x ^ (x >> 31);
+}
+
+
+static uint64_t hash_bytes(const char *bytes, size_t len)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL ^ len;
+	size_t i = 0;
+	for (; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t)) {
+		uint64_t word;
+		memcpy(&word, bytes + i, sizeof word);
+		hash = mix_hash(hash ^ word);
+	}
+	if (i < len) {
+		uint64_t word = 0;
+		memcpy(&word, bytes + i, len - i);
+		hash = mix_hash(hash ^ word);
+	}
+	return hash;
+}
+
+
+candidate_filter::candidate_filter(enum dedupe_mode mode, size_t memory_limit)
+{
+	this->mode = mode;
+	this->memory_limit = memory_limit;
+	this->full = false;
+	this->n_used = 0;
+	this->blocks = NULL;
+	this->n_blocks = 0;
+	if (mode == DEDUPE_EXACT) {
+		slots.assign(DEDUPE_INITIAL_SLOTS, (slot){0, 0});
+		return;
+	}
+
+	// Largest power of two number of blocks within the bound
+	n_blocks = 1;
+	while (2 * n_blocks * DEDUPE_BLOCK_WORDS * sizeof(uint64_t) <=
+	       memory_limit)
+		n_blocks *= 2;
+	// Anonymous mappings are zeroed lazily, page by page
+	blocks_size = n_blocks * DEDUPE_BLOCK_WORDS * sizeof(uint64_t);
+	blocks = (uint64_t*)mmap(NULL, blocks_size, PROT_READ | PROT_WRITE,
+				 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (blocks == MAP_FAILED) {
+		cerr << __func__ << ": Out of memory...\n";
+		blocks = NULL;
+		n_blocks = 0;
+	}
+}
+
+
+candidate_filter::~candidate_filter(void)
+{
+	if (blocks)
+		munmap(blocks, blocks_size);
+}
+
+
+bool candidate_filter::grow_table(void)
+{
+	size_t new_size = 2 * slots.size();
+	vector<slot> new_slots;
+	if (new_size * sizeof(slot) + arena.capacity() > memory_limit)
+		return false;
+
+	new_slots.assign(new_size, (slot){0, 0});
+	for (const slot& s : slots) {
+		size_t i;
+		if (s.hash == 0)
+			continue;
+		for (i=s.hash & (new_size - 1); new_slots[i].hash;
+		     i=(i + 1) & (new_size - 1))
+			;
+		new_slots[i] = s;
+	}
+	slots.swap(new_slots);
+	return true;
+}
+
+
+/* Makes room for needed more arena bytes without exceeding the bound */
+bool candidate_filter::reserve_arena(size_t needed)
+{
+	size_t table_size = slots.size() * sizeof(slot);
+	size_t capacity = arena.capacity();
+	if (arena.size() + needed <= capacity)
+		return true;
+
+	capacity = max(2 * capacity, arena.size() + needed);
+	if (table_size + capacity > memory_limit)
+		capacity = memory_limit > table_size ? memory_limit - table_size
+						     : 0;
+	if (arena.size() + needed > capacity)
+		return false;
+	arena.reserve(capacity);
+	return true;
+}
+
+
+/*
+ * A hash of 0 marks empty slots, candidates hashing to it are moved to 1.
+ * Arena entries are a 32-bit length followed by the candidate.
+ */
+bool candidate_filter::insert_exact(uint64_t hash)
+{
+	size_t mask = slots.size() - 1, i;
+	uint32_t len = scratch.size();
+
+	hash = hash ? hash : 1;
+	for (i=hash & mask; slots[i].hash; i=(i + 1) & mask) {
+		const char *entry;
+		uint32_t entry_len;
+		if (slots[i].hash != hash)
+			continue;
+		entry = &arena[slots[i].offset];
+		memcpy(&entry_len, entry, sizeof entry_len);
+		if (entry_len == len &&
+		    !memcmp(entry + sizeof entry_len, scratch.data(), len))
+			return false;
+	}
+	if (full)
+		return true;
+
+	// Keep the table at most half full
+	if (2 * (n_used + 1) > slots.size()) {
+		if (!grow_table())
+			goto exhausted;
+		mask = slots.size() - 1;
+		for (i=hash & mask; slots[i].hash; i=(i + 1) & mask)
+			;
+	}
+	if (!reserve_arena(sizeof len + len))
+		goto exhausted;
+	slots[i] = (slot){hash, arena.size()};
+	arena.insert(arena.end(), (const char*)&len,
+		     (const char*)&len + sizeof len);
+	arena.insert(arena.end(), scratch.begin(), scratch.end());
+	n_used++;
+	return true;
+ exhausted:
+	cerr << "Deduplication memory exhausted, later candidates are no "
+	     << "longer remembered\n";
+	full = true;
+	return true;
+}
+
+
+bool candidate_filter::insert_approximate(uint64_t hash)
+{
+	uint64_t *block, bits;
+	uint32_t first, step;
+	bool seen = true;
+	if (n_blocks == 0)
+		return true;
+
+	block = blocks + (hash & (n_blocks - 1)) * DEDUPE_BLOCK_WORDS;
+	// Bit positions within the block by double hashing a second hash
+	bits = mix_hash(hash);
+	first = bits;
+	step = (bits >> 32) | 1;
+	for (int k=0; k<DEDUPE_BLOOM_HASHES; k++) {
+		uint32_t bit = (first + k * step) & (DEDUPE_BLOCK_WORDS * 64 - 1);
+		uint64_t mask = (uint64_t)1 << (bit & 63);
+		seen &= (block[bit >> 6] & mask) != 0;
+		block[bit >> 6] |= mask;
+	}
+	return !seen;
+}
+
+
+bool candidate_filter::insert(const char *const *parts, const size_t *lens,
+			      int n_parts)
+{
+	uint64_t hash;
+	scratch.clear();
+	for (int i=0; i<n_parts; i++)
+		scratch.append(parts[i], lens[i]);
+	hash = hash_bytes(scratch.data(), scratch.size());
+
+	if (mode == DEDUPE_EXACT)
+		return insert_exact(hash);
+	return insert_approximate(hash);
+}
@@ -0,0 +1,67 @@
+#ifndef DEDUPE_H
+#define DEDUPE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#define DEDUPE_DEFAULT_MEMORY ((size_t)1 << 30)
+// Bits set per candidate in a block of the approximate filter
+#define DEDUPE_BLOOM_HASHES 8
+
+
+using namespace std;
+
+
+enum dedupe_mode {
+	// Remembers every candidate until the memory bound is reached, and
+	// only the ones seen until then afterwards
+	DEDUPE_EXACT,
+	// Blocked Bloom filter, a small fraction of unique candidates is
+	// dropped as false positives
+	DEDUPE_APPROXIMATE,
+};
+
+
+/*
+ * Set of the candidates printed so far, at most memory_limit bytes large.
+ *
+ * The exact set keeps candidates in an append only arena and their hashes in
+ * an open addressing table of (hash, arena offset) slots, most lookups never
+ * touch the arena. The approximate filter sets all bits of a candidate in
+ * one 64 byte block, costing a single cache miss per candidate.
+ */
+class candidate_filter {
+	private:
+	enum dedupe_mode mode;
+	size_t memory_limit;
+	bool full;
+	string scratch;
+	// Exact mode
+	struct slot {
+		uint64_t hash, offset;
+	};
+	vector<slot> slots;
+	size_t n_used;
+	vector<char> arena;
+	// Approximate mode
+	uint64_t *blocks;
+	uint64_t n_blocks;
+	size_t blocks_size;
+	bool insert_exact(uint64_t hash);
+	bool insert_approximate(uint64_t hash);
+	bool grow_table(void);
+	bool reserve_arena(size_t needed);
+	public:
+	candidate_filter(enum dedupe_mode mode,
+			 size_t memory_limit = DEDUPE_DEFAULT_MEMORY);
+	candidate_filter(const candidate_filter&) = delete;
+	candidate_filter& operator =(const candidate_filter&) = delete;
+	// True if the candidate made of the parts was not seen before
+	bool insert(const char *const *parts, const size_t *lens, int n_parts);
+	~candidate_filter(void);
+};
+
+
+#endif /* DEDUPE_H */
@@ -1,27 +1,95 @@
 #include <math.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <string.h>
 #include <algorithm>
+#include <iostream>
 #include "dag_implicit.hpp"
+#include "slab_pool.hpp"
 #include "event_iterator.hpp"
 
 #define ALLOC(x, n) (x = (typeof(x))malloc(n * sizeof(*(x))))
 #define STATIC_ARRLEN(array) (sizeof(array)/sizeof(*(array)))
 #define THROW_ERROR(str) \
 	(fprintf(stderr, "Error in %s: " str "...\n", __func__))
-
-
-// XXX: Global variable to emulate the expand closure (do not run the iterator
-// in more than one thread).
-static event_list *__global_event_list;
-
-
+#define OUTCOME_LIST_INLINE 24
+
+
+/*
+ * Packed outcome indices of a point in the event lattice. The first (prefix)
+ * and last (suffix) events get 32-bit fields, every event in between is a
+ * character event with at most 256 outcomes and takes a single byte. Those
+ * bytes are stored inline for seeds of up to OUTCOME_LIST_INLINE characters
+ * and spill into a pool shared by the lists of one iteration otherwise. The
+ * hash is kept up to date by set() so most comparisons never look at the
+ * indices themselves.
+ */
 class outcome_list {
+	private:
+	int compare(const outcome_list& rhs) const;
+	inline int n_narrow(void) const
+	{
+		return n_events > 2 ? n_events - 2 : 0;
+	}
+	inline uint8_t *narrow_bytes(void)
+	{
+		return n_narrow() > OUTCOME_LIST_INLINE ? narrow.remote.bytes
+							: narrow.local;
+	}
+	inline const uint8_t *narrow_bytes(void) const
+	{
+		return n_narrow() > OUTCOME_LIST_INLINE ? narrow.remote.bytes
+							: narrow.local;
+	}
 	public:
 	int n_events;
-	int *outcome_idx_list;
-	inline outcome_list(void) {}
-	outcome_list(int n_events, int *outcome_idx_list);
+	// Last stepped event, see ENUMERATE_CANONICAL
+	int pivot;
+	uint32_t first_idx, last_idx;
+	uint64_t hash;
+	union {
+		uint8_t local[OUTCOME_LIST_INLINE];
+		struct {
+			uint8_t *bytes;
+			slab_pool *pool;
+		} remote;
+	} narrow;
+	inline outcome_list(void) : n_events(0), pivot(0), hash(0) {}
+	// The pool must hold n_events - 2 bytes per block and outlive the list
+	outcome_list(int n_events, slab_pool *pool);
 	outcome_list(const outcome_list& list);
+	outcome_list(outcome_list&& list);
+	outcome_list& operator =(const outcome_list& list);
+	outcome_list& operator =(outcome_list&& list);
+	inline int get(int event_idx) const
+	{
+		if (event_idx == 0)
+			return first_idx;
+		if (event_idx == n_events - 1)
+			return last_idx;
+		return narrow_bytes()[event_idx - 1];
+	}
+	inline void set(int event_idx, int outcome_idx)
+	{
+		hash -= outcome_hash(event_idx, get(event_idx));
+		hash += outcome_hash(event_idx, outcome_idx);
+		if (event_idx == 0)
+			first_idx = outcome_idx;
+		else if (event_idx == n_events - 1)
+			last_idx = outcome_idx;
+		else
+			narrow_bytes()[event_idx - 1] = outcome_idx;
+	}
+	static inline uint64_t outcome_hash(int event_idx, uint32_t outcome_idx)
+	{
+		uint64_t x = ((uint64_t)event_idx << 32) | outcome_idx;
+		x ^= x >> 33;
+		x *= 0xff51afd7ed558ccdULL;
+		x ^= x >> 33;
+		x *= 0xc4ceb9fe1a85ec53ULL;
+		x ^= x >> 33;
+		return x;
+	}
 	bool operator <(const outcome_list& rhs) const;
 	bool operator >(const outcome_list& rhs) const;
 	bool operator <=(const outcome_list& rhs) const;
@@ -38,210 +106,499 @@ static int likelier(struct outcome a, struct outcome b)
 }
 
 
-static double outcome_list_delta(outcome_list* l_prev, outcome_list* l_next)
-{
-	int i, n_events = l_prev->n_events;
-	struct outcome prev, next;
-	for (i=0; i<n_events; i++)
-		if (l_prev->outcome_idx_list[i] != l_next->outcome_idx_list[i])
-			break;
-	if (i == n_events)
-		return 0.0;
-	prev = __global_event_list->events[i][l_prev->outcome_idx_list[i]];
-	next = __global_event_list->events[i][l_next->outcome_idx_list[i]];
-	return prev.logarithmic_probability - next.logarithmic_probability;
-}
+/*
+ * Graph callables of the outcome lattice. Both keep a pointer to the sorted
+ * sample spaces so the iteration needs no global state.
+ */
+struct outcome_list_delta {
+	const vector<outcome_span> *events;
+	bool canonical;
+	inline double operator ()(const outcome_list& l_prev,
+				  const outcome_list& l_next) const
+	{
+		int i, n_events = l_prev.n_events;
+		if (canonical) {
+			i = l_next.pivot;
+		} else {
+			for (i=0; i<n_events; i++)
+				if (l_prev.get(i) != l_next.get(i))
+					break;
+			if (i == n_events)
+				return 0.0;
+		}
+		const outcome& prev = (*events)[i][l_prev.get(i)];
+		const outcome& next = (*events)[i][l_next.get(i)];
+		return prev.logarithmic_probability -
+		       next.logarithmic_probability;
+	}
+};
+
+
+struct outcome_list_expander {
+	const vector<outcome_span> *events;
+	bool canonical;
+	inline void operator ()(const outcome_list& list,
+				vector<outcome_list>& next_outcomes) const
+	{
+		int n_events = list.n_events;
+		const vector<outcome_span>& ev_table = *events;
+		for (int i=canonical ? list.pivot : 0; i<n_events; i++) {
+			int new_outcome_idx = list.get(i) + 1;
+			if (new_outcome_idx >= ev_table[i].size())
+				continue;
+			next_outcomes.push_back(list);
+			next_outcomes.back().set(i, new_outcome_idx);
+			next_outcomes.back().pivot = i;
+		}
+	}
+};
 
 
-static void print_outcome_list(outcome_list *list)
+typedef dag_implicit<outcome_list, outcome_list_expander, outcome_list_delta>
+	outcome_dag;
+
+
+struct cursor_state {
+	const event_list *list;
+	slab_pool index_pool;
+	outcome_dag dag;
+	outcome_dag::dijkstra_iterator iterator;
+	bool started;
+	cursor_state(const event_list *list);
+};
+
+
+static outcome_dag::dijkstra_iterator
+start_iteration(const event_list *list, outcome_dag& dag, slab_pool *pool)
 {
-	char *sep = (char*)"{";
 	int n_events = list->n_events;
-	int *outcome_idx_list = list->outcome_idx_list;
-	const vector<vector<outcome>>& ev_table = __global_event_list->events;
+	const vector<outcome_span>& events = list->events;
+	double best_logprob = 0.0;
 	for (int i=0; i<n_events; i++) {
-		int outcome_idx = outcome_idx_list[i];
-		cout << sep << ev_table[i][outcome_idx].identifier;
-		sep = (char*)", ";
+		if (events[i].empty())
+			// Empty sample space, there is nothing to enumerate
+			return dag.end();
+		best_logprob += events[i][0].logarithmic_probability;
 	}
-	cout << "}";
+	for (int i=1; i<n_events-1; i++)
+		if (events[i].size() > 256) {
+			THROW_ERROR("Character event with over 256 outcomes");
+			return dag.end();
+		}
+
+	// Costs are log-probability drops relative to the likeliest list
+	dag.set_limits(list->max_candidates, best_logprob - list->min_logprob);
+	dag.set_start(outcome_list(n_events, pool));
+	return dag.begin();
+}
+
+
+cursor_state::cursor_state(const event_list *list)
+	: list(list),
+	  index_pool(list->n_events > 2 ? list->n_events - 2 : 1),
+	  dag((outcome_list_expander){&list->events,
+				      list->mode == ENUMERATE_CANONICAL},
+	      (outcome_list_delta){&list->events,
+				   list->mode == ENUMERATE_CANONICAL},
+	      list->mode != ENUMERATE_CANONICAL),
+	  iterator(start_iteration(list, dag, &index_pool))
+{
+	started = false;
+}
+
+
+event_cursor::event_cursor(const event_list& list)
+{
+	state = new cursor_state(&list);
 }
 
 
-static vector<outcome_list> expand_outcome_list(outcome_list *list)
+event_cursor::~event_cursor(void)
 {
-	int n_events, *outcome_idx_list;
-	vector<outcome_list> next_outcomes;
+	delete state;
+}
+
 
-	n_events = list->n_events;
-	outcome_idx_list = list->outcome_idx_list;
-	const vector<vector<outcome>>& ev_table = __global_event_list->events;
-	outcome_list next_list(n_events, NULL);
+bool event_cursor::next(vector<int>& outcomes, double& logprob)
+{
+	int n_events = state->list->n_events;
+	const vector<outcome_span>& events = state->list->events;
+
+	if (state->started)
+		++state->iterator;
+	state->started = true;
+	if (state->iterator.complete())
+		return false;
+
+	const outcome_list& event = *state->iterator;
+	outcomes.resize(n_events);
+	logprob = 0.0;
 	for (int i=0; i<n_events; i++) {
-		int old_outcome_idx = outcome_idx_list[i];
-		int new_outcome_idx = old_outcome_idx + 1;
-		if (new_outcome_idx >= ev_table[i].size())
-			continue;
-		outcome_idx_list[i] = new_outcome_idx;
-		next_list.outcome_idx_list = outcome_idx_list;
-		next_outcomes.push_back(next_list);
-		outcome_idx_list[i] = old_outcome_idx;
+		const outcome& o = events[i][event.get(i)];
+		outcomes[i] = o.identifier;
+		logprob += o.logarithmic_probability;
 	}
+	return true;
+}
+
 
-	// Do not let the destructor free the base outcome list
-	next_list.outcome_idx_list = NULL;
-	return next_outcomes;
+void event_cursor::get_stats(struct enumeration_stats& stats) const
+{
+	struct dijkstra_stats counters;
+	state->iterator.get_stats(counters);
+	stats.nodes_expanded = counters.nodes_expanded;
+	stats.successors_generated = counters.successors_generated;
+	stats.successors_deduplicated = counters.successors_deduplicated;
+	stats.successors_pruned = counters.successors_pruned;
+	stats.nodes_trimmed = counters.nodes_trimmed;
+	stats.frontier_size = counters.frontier_size;
+	stats.frontier_peak = counters.frontier_peak;
+	stats.enqueued_size = counters.enqueued_size;
 }
 
 
-void event_list::iterate_sorted(iterator_cb_t iterator_cb, void *cb_data)
+template <class V>
+static inline void write_value(ostream& out, V value)
 {
-	int *seed_list;
-	__global_event_list = this;
-	dag_implicit<outcome_list> event_base(expand_outcome_list,
-						  outcome_list_delta);
-	if (!ALLOC(seed_list, n_events))
-		goto oom;
-	for (int i=0; i<n_events; i++)
-		seed_list[i] = 0;
-
-	event_base.set_start(outcome_list(n_events, seed_list));
-	for (const outcome_list& event : event_base) {
-		vector<int> outcome_identifiers;
-		for (int i=0; i<event.n_events; i++) {
-			int outcome_idx = event.outcome_idx_list[i];
-			int id = events[i][outcome_idx].identifier;
-			outcome_identifiers.push_back(id);
+	out.write((const char*)&value, sizeof value);
+}
+
+
+template <class V>
+static inline bool read_value(istream& in, V& value)
+{
+	return (bool)in.read((char*)&value, sizeof value);
+}
+
+
+uint64_t event_list::fingerprint(void) const
+{
+	// FNV-1a over the words describing the list
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	auto mix = [&hash](uint64_t word) {
+		hash = (hash ^ word) * 0x100000001b3ULL;
+	};
+	mix(n_events);
+	mix(mode);
+	for (const outcome_span& event : events) {
+		mix(event.size());
+		for (const outcome& o : event) {
+			uint64_t logprob_bits;
+			memcpy(&logprob_bits, &o.logarithmic_probability,
+			       sizeof logprob_bits);
+			mix(o.identifier);
+			mix(logprob_bits);
 		}
-		iterator_cb(outcome_identifiers, cb_data);
 	}
-
-	return;
- oom:
-	THROW_ERROR("Out of memory");
+	return hash;
 }
 
 
-static void sort_sample_space(vector<struct outcome>& unsorted)
+/*
+ * Layout: list fingerprint, n_events, started flag, limits left, number of
+ * frontier nodes and the nodes in heap order, each with its cost, depth,
+ * pivot and outcome indices (32 bits for the first and last event, 8 for
+ * the rest).
+ */
+bool event_cursor::save(ostream& out) const
 {
-	std::sort(unsorted.begin(), unsorted.end(), likelier);
+	const event_list *list = state->list;
+	int n_events = list->n_events;
+	unsigned long long max_nodes;
+	double max_cost;
+
+	state->iterator.get_limits(max_nodes, max_cost);
+	const auto& frontier = state->iterator.frontier();
+	write_value<uint64_t>(out, list->fingerprint());
+	write_value<uint32_t>(out, n_events);
+	write_value<uint8_t>(out, state->started);
+	write_value<uint64_t>(out, max_nodes);
+	write_value<double>(out, max_cost);
+	write_value<uint64_t>(out, frontier.size());
+	for (const auto& nc : frontier) {
+		const outcome_list& node = *nc.destination_node;
+		write_value<double>(out, nc.total_cost);
+		write_value<uint64_t>(out, nc.depth);
+		write_value<uint32_t>(out, node.pivot);
+		for (int i=0; i<n_events; i++)
+			if (i == 0 || i == n_events - 1)
+				write_value<uint32_t>(out, node.get(i));
+			else
+				write_value<uint8_t>(out, node.get(i));
+	}
+	return out.good();
 }
 
 
-bool outcome_list::operator <(const outcome_list& rhs) const
+bool event_cursor::restore(istream& in)
 {
-	if (n_events != rhs.n_events)
+	const event_list *list = state->list;
+	int n_events = list->n_events;
+	const vector<outcome_span>& events = list->events;
+	uint64_t fingerprint, max_nodes, n_nodes;
+	uint32_t saved_events;
+	uint8_t started;
+	double max_cost;
+
+	if (!read_value(in, fingerprint) || !read_value(in, saved_events) ||
+	    !read_value(in, started) || !read_value(in, max_nodes) ||
+	    !read_value(in, max_cost) || !read_value(in, n_nodes)) {
+		THROW_ERROR("Truncated checkpoint");
+		return false;
+	}
+	if (fingerprint != list->fingerprint() || saved_events != n_events) {
+		THROW_ERROR("Checkpoint of a different event list");
 		return false;
-	for (int i=0; i<n_events; i++) {
-		if (outcome_idx_list[i] < rhs.outcome_idx_list[i])
-			return true;
-		if (outcome_idx_list[i] > rhs.outcome_idx_list[i])
-			return false;
 	}
+
+	state->iterator.restore_limits(max_nodes, max_cost);
+	for (uint64_t j=0; j<n_nodes; j++) {
+		outcome_list node(n_events, &state->index_pool);
+		double total_cost;
+		uint64_t depth;
+		uint32_t pivot;
+		if (!read_value(in, total_cost) || !read_value(in, depth) ||
+		    !read_value(in, pivot) || pivot >= n_events)
+			goto corrupt;
+		node.pivot = pivot;
+		for (int i=0; i<n_events; i++) {
+			uint32_t idx;
+			uint8_t narrow_idx;
+			if (i == 0 || i == n_events - 1) {
+				if (!read_value(in, idx))
+					goto corrupt;
+			} else {
+				if (!read_value(in, narrow_idx))
+					goto corrupt;
+				idx = narrow_idx;
+			}
+			if (idx >= events[i].size())
+				goto corrupt;
+			node.set(i, idx);
+		}
+		state->iterator.restore_node(move(node), total_cost, depth);
+	}
+	if (!is_heap(state->iterator.frontier().begin(),
+		     state->iterator.frontier().end(),
+		     greater<node_cost<outcome_list>>()))
+		goto corrupt;
+	state->started = started;
+	return true;
+ corrupt:
+	THROW_ERROR("Corrupt checkpoint");
+	state->iterator.restore_limits(0, INFINITY);
 	return false;
 }
 
 
-bool outcome_list::operator >(const outcome_list& rhs) const
+void event_list::iterate_sorted(iterator_cb_t iterator_cb, void *cb_data)
 {
-	if (n_events != rhs.n_events)
-		return false;
+	event_cursor cursor(*this);
+	vector<int> outcome_identifiers(n_events);
+	double logprob;
+
+	while (cursor.next(outcome_identifiers, logprob))
+		if (!iterator_cb(outcome_identifiers, logprob, cb_data))
+			break;
+}
+
+
+int event_list::partition_event(void) const
+{
+	int largest = 0;
+	for (int i=1; i<n_events; i++)
+		if (events[i].size() > events[largest].size())
+			largest = i;
+	return largest;
+}
+
+
+event_list *event_list::partition(int event_idx, int n_parts, int part) const
+{
+	event_list *list = new event_list(n_events);
+	list->mode = mode;
+	list->max_candidates = max_candidates;
+	list->min_logprob = min_logprob;
 	for (int i=0; i<n_events; i++) {
-		if (outcome_idx_list[i] > rhs.outcome_idx_list[i])
-			return true;
-		if (outcome_idx_list[i] < rhs.outcome_idx_list[i])
-			return false;
+		if (i != event_idx) {
+			list->events[i] = events[i];
+			continue;
+		}
+		// Striping keeps the sample space sorted
+		for (int j=part; j<events[i].size(); j+=n_parts)
+			list->storage[i].push_back(events[i][j]);
+		list->events[i] = (outcome_span){list->storage[i].data(),
+						 list->storage[i].size()};
 	}
-	return false;
+	return list;
 }
 
 
-bool outcome_list::operator <=(const outcome_list& rhs) const
+static void sort_sample_space(outcome *begin, outcome *end)
 {
+	std::sort(begin, end, likelier);
+}
+
+
+int outcome_list::compare(const outcome_list& rhs) const
+{
+	if (hash != rhs.hash)
+		return hash < rhs.hash ? -1 : 1;
 	if (n_events != rhs.n_events)
-		return false;
-	for (int i=0; i<n_events; i++) {
-		if (outcome_idx_list[i] < rhs.outcome_idx_list[i])
-			return true;
-		if (outcome_idx_list[i] > rhs.outcome_idx_list[i])
-			return false;
+		return n_events < rhs.n_events ? -1 : 1;
+	if (first_idx != rhs.first_idx)
+		return first_idx < rhs.first_idx ? -1 : 1;
+	if (last_idx != rhs.last_idx)
+		return last_idx < rhs.last_idx ? -1 : 1;
+	if (n_narrow() > OUTCOME_LIST_INLINE)
+		return memcmp(narrow.remote.bytes, rhs.narrow.remote.bytes,
+			      n_narrow());
+
+	// Inline bytes past n_narrow() are kept zeroed, compare whole words
+	for (int i=0; i<OUTCOME_LIST_INLINE; i+=sizeof(uint64_t)) {
+		uint64_t lhs_word, rhs_word;
+		memcpy(&lhs_word, &narrow.local[i], sizeof lhs_word);
+		memcpy(&rhs_word, &rhs.narrow.local[i], sizeof rhs_word);
+		if (lhs_word != rhs_word)
+			return lhs_word < rhs_word ? -1 : 1;
 	}
-	return true;
+	return 0;
+}
+
+
+bool outcome_list::operator <(const outcome_list& rhs) const
+{
+	return compare(rhs) < 0;
+}
+
+
+bool outcome_list::operator >(const outcome_list& rhs) const
+{
+	return compare(rhs) > 0;
+}
+
+
+bool outcome_list::operator <=(const outcome_list& rhs) const
+{
+	return compare(rhs) <= 0;
 }
 
 
 bool outcome_list::operator >=(const outcome_list& rhs) const
 {
-	if (n_events != rhs.n_events)
-		return false;
-	for (int i=0; i<n_events; i++) {
-		if (outcome_idx_list[i] > rhs.outcome_idx_list[i])
-			return true;
-		if (outcome_idx_list[i] < rhs.outcome_idx_list[i])
-			return false;
-	}
-	return true;
+	return compare(rhs) >= 0;
 }
 
 
 bool outcome_list::operator ==(const outcome_list& rhs) const
 {
-	if (n_events != rhs.n_events)
-		return false;
-	for (int i=0; i<n_events; i++) {
-		if (outcome_idx_list[i] != rhs.outcome_idx_list[i])
-			return false;
-	}
-	return true;
+	return compare(rhs) == 0;
 }
 
 
 bool outcome_list::operator !=(const outcome_list& rhs) const
 {
-	if (n_events != rhs.n_events)
-		return true;
-	for (int i=0; i<n_events; i++) {
-		if (outcome_idx_list[i] != rhs.outcome_idx_list[i])
-			return true;
-	}
-	return false;
+	return compare(rhs) != 0;
 }
 
 
-outcome_list::outcome_list(int n_events, int *outcome_idx_list)
+outcome_list::outcome_list(int n_events, slab_pool *pool)
 {
 	this->n_events = n_events;
-	this->outcome_idx_list = outcome_idx_list;
+	pivot = 0;
+	first_idx = last_idx = 0;
+	if (n_narrow() > OUTCOME_LIST_INLINE) {
+		narrow.remote.pool = pool;
+		narrow.remote.bytes = (uint8_t*)pool->acquire();
+		memset(narrow.remote.bytes, 0, n_narrow());
+	} else
+		memset(narrow.local, 0, sizeof narrow.local);
+	hash = 0;
+	for (int i=0; i<n_events; i++)
+		hash += outcome_hash(i, 0);
 }
 
 
 outcome_list::outcome_list(const outcome_list& list)
 {
 	n_events = list.n_events;
-	if (!ALLOC(outcome_idx_list, list.n_events))
-		goto oom;
-	for (int i=0; i<list.n_events; i++)
-		outcome_idx_list[i] = list.outcome_idx_list[i];
-	return;
- oom:
-	THROW_ERROR("Out of memory");
+	pivot = list.pivot;
+	first_idx = list.first_idx;
+	last_idx = list.last_idx;
+	hash = list.hash;
+	if (n_narrow() > OUTCOME_LIST_INLINE) {
+		slab_pool *pool = list.narrow.remote.pool;
+		narrow.remote.pool = pool;
+		narrow.remote.bytes = (uint8_t*)pool->acquire();
+		memcpy(narrow.remote.bytes, list.narrow.remote.bytes,
+		       n_narrow());
+	} else
+		narrow = list.narrow;
+}
+
+
+outcome_list::outcome_list(outcome_list&& list)
+{
+	n_events = list.n_events;
+	pivot = list.pivot;
+	first_idx = list.first_idx;
+	last_idx = list.last_idx;
+	hash = list.hash;
+	narrow = list.narrow;
+	// The moved-from list no longer owns any remote bytes
+	list.n_events = 0;
+}
+
+
+outcome_list& outcome_list::operator =(const outcome_list& list)
+{
+	if (this == &list)
+		return *this;
+	this->~outcome_list();
+	new (this) outcome_list(list);
+	return *this;
+}
+
+
+outcome_list& outcome_list::operator =(outcome_list&& list)
+{
+	if (this == &list)
+		return *this;
+	this->~outcome_list();
+	new (this) outcome_list(move(list));
+	return *this;
 }
 
 
 outcome_list::~outcome_list(void)
 {
-	if (outcome_idx_list)
-		free(outcome_idx_list);
+	if (n_narrow() > OUTCOME_LIST_INLINE)
+		narrow.remote.pool->release(narrow.remote.bytes);
 }
 
 
 event_list::event_list(int n_events)
 {
 	this->n_events = n_events;
-	for (int i=0; i<n_events; i++) {
-		vector<outcome> empty;
-		events.push_back(empty);
-	}
+	this->mode = ENUMERATE_CANONICAL;
+	this->max_candidates = 0;
+	this->min_logprob = -INFINITY;
+	events.assign(n_events, (outcome_span){NULL, 0});
+	storage.resize(n_events);
+}
+
+
+void event_list::set_enumeration_mode(enum enumeration_mode mode)
+{
+	this->mode = mode;
+}
+
+
+void event_list::set_limits(unsigned long long max_candidates,
+			    double min_logprob)
+{
+	this->max_candidates = max_candidates;
+	this->min_logprob = min_logprob;
 }
 
 
@@ -251,26 +608,43 @@ event_list::~event_list(void)
 }
 
 
-void event_list::set_event_sample_space(int event_idx, vector<int> outcomes,
-					vector<unsigned long long> freqs)
+void normalize_sample_space(const unsigned long long *freqs, size_t n_outcomes,
+			    outcome *dest)
 {
 	double freq_sum_log = 0.0;
 	unsigned long long freq_sum = 0;
-	for (auto freq : freqs)
-		freq_sum += freq;
+	for (size_t i=0; i<n_outcomes; i++)
+		freq_sum += freqs[i];
 	freq_sum_log = log((double)freq_sum);
 
-	for (int i=0; i<outcomes.size(); i++) {
+	for (size_t i=0; i<n_outcomes; i++) {
 		double freq_log = log((double)freqs[i]);
-		events[event_idx].push_back((struct outcome){
-			.identifier = outcomes[i],
-			.added_index = i,
+		dest[i] = (struct outcome){
+			.identifier = (int)i,
+			.added_index = (int)i,
 			.logarithmic_probability = freq_log - freq_sum_log,
-		});
+		};
 	}
-	sort_sample_space(events[event_idx]);
+	sort_sample_space(dest, dest + n_outcomes);
+}
 
-	return;
- oom:
-	THROW_ERROR("Out of memory");
+
+void event_list::set_event_sample_space(int event_idx, vector<int> outcomes,
+					vector<unsigned long long> freqs)
+{
+	vector<outcome>& sample_space = storage[event_idx];
+	sample_space.resize(outcomes.size());
+	normalize_sample_space(freqs.data(), outcomes.size(),
+			       sample_space.data());
+	for (auto& o : sample_space)
+		o.identifier = outcomes[o.added_index];
+	events[event_idx] = (outcome_span){sample_space.data(),
+					   sample_space.size()};
+}
+
+
+void event_list::set_event_outcomes(int event_idx, outcome_span outcomes)
+{
+	storage[event_idx].clear();
+	events[event_idx] = outcomes;
 }
@@ -1,13 +1,30 @@
 #ifndef EVENT_ITERATOR
 #define EVENT_ITERATOR
 
+#include <stddef.h>
+#include <stdint.h>
+#include <iosfwd>
 #include <vector>
 
 
 using namespace std;
 
 
-typedef void (*iterator_cb_t)(const vector<int>& outcomes, void *cb_data);
+/* Returning false from the callback stops the iteration */
+typedef bool (*iterator_cb_t)(const vector<int>& outcomes, double logprob,
+			      void *cb_data);
+
+
+/*
+ * ENUMERATE_DEDUPLICATED steps any single event of a visited outcome list and
+ * relies on a set of enqueued lists to drop duplicates. ENUMERATE_CANONICAL
+ * only steps events at or after the last stepped one, which reaches every
+ * outcome list from exactly one parent and needs no set at all.
+ */
+enum enumeration_mode {
+	ENUMERATE_DEDUPLICATED,
+	ENUMERATE_CANONICAL,
+};
 
 
 struct outcome {
@@ -15,14 +32,111 @@ struct outcome {
 	double logarithmic_probability;
 };
 
+
+/* Read-only view of a sample space sorted likeliest first */
+struct outcome_span {
+	const outcome *outcomes;
+	size_t n_outcomes;
+	inline size_t size(void) const { return n_outcomes; }
+	inline bool empty(void) const { return n_outcomes == 0; }
+	inline const outcome *begin(void) const { return outcomes; }
+	inline const outcome *end(void) const { return outcomes + n_outcomes; }
+	inline const outcome& operator [](size_t idx) const
+	{
+		return outcomes[idx];
+	}
+};
+
+
+/*
+ * Fills dest with the outcomes 0 to n_outcomes - 1 weighted by freqs, with
+ * log-probabilities normalized over the sum of freqs and sorted likeliest
+ * first.
+ */
+void normalize_sample_space(const unsigned long long *freqs, size_t n_outcomes,
+			    outcome *dest);
+
+
 class event_list {
 	public:
 	int n_events;
-	vector<vector<outcome>> events;
+	enum enumeration_mode mode;
+	// Iteration stops after max_candidates lists (0 for no limit) and never
+	// visits lists less likely than min_logprob
+	unsigned long long max_candidates;
+	double min_logprob;
+	vector<outcome_span> events;
+	// Sample spaces owned by the list, events may also view outside memory
+	vector<vector<outcome>> storage;
 	event_list(int n_events);
+	void set_enumeration_mode(enum enumeration_mode mode);
+	void set_limits(unsigned long long max_candidates, double min_logprob);
 	void set_event_sample_space(int event_idx, vector<int> outcomes,
 				    vector<unsigned long long> freqs);
+	// Views a sample space prepared by normalize_sample_space without
+	// copying it, the outcomes must outlive the list
+	void set_event_outcomes(int event_idx, outcome_span outcomes);
+	// Event with the largest sample space, the one lattices are split on
+	int partition_event(void) const;
+	// Hash of the mode and sample spaces, tells event lists apart
+	uint64_t fingerprint(void) const;
+	// Copy of the list keeping only outcomes part, part + n_parts, ... of
+	// event_idx. The n_parts copies split the lattice into disjoint parts
+	// and view the other sample spaces of this list, which must outlive them.
+	event_list *partition(int event_idx, int n_parts, int part) const;
 	void iterate_sorted(iterator_cb_t iterator_cb, void *cb_data);
+	// Same order as iterate_sorted but with the lattice split over up to
+	// n_threads threads whose sorted streams are merged. Any part may hold
+	// all of the max_candidates likeliest candidates, so each one keeps the
+	// full limit and the search frontiers take up to n_threads times the
+	// memory of a serial run.
+	void iterate_sorted_parallel(iterator_cb_t iterator_cb, void *cb_data,
+				     int n_threads);
+	// Approximate order in constant memory: lists are enumerated in bands
+	// of band_width nats of log-probability, in no particular order
+	// within a band. No list follows one that is n_events band widths
+	// less likely or more.
+	void iterate_banded(iterator_cb_t iterator_cb, void *cb_data,
+			    double band_width);
+	// Counts lists by log-probability without enumerating them: at least
+	// lower lists are likelier than logprob and at most upper are at
+	// least as likely. More bins narrow the bounds.
+	void count_likelier(double logprob, int n_bins, double& lower,
+			    double& upper) const;
 	~event_list(void);
 };
+
+
+/* Progress of an enumeration, see dijkstra_stats */
+struct enumeration_stats {
+	unsigned long long nodes_expanded;
+	unsigned long long successors_generated, successors_deduplicated;
+	unsigned long long successors_pruned, nodes_trimmed;
+	unsigned long long frontier_size, frontier_peak, enqueued_size;
+};
+
+
+/*
+ * Pull based counterpart of iterate_sorted, every call to next() yields the
+ * following outcome list in the same order. The event_list must outlive the
+ * cursor and stay unchanged while it is in use.
+ */
+class event_cursor {
+	private:
+	struct cursor_state *state;
+	public:
+	event_cursor(const event_list& list);
+	event_cursor(const event_cursor&) = delete;
+	event_cursor& operator =(const event_cursor&) = delete;
+	// False once the iteration is over
+	bool next(vector<int>& outcomes, double& logprob);
+	// Writes the position of the cursor. A cursor of an identical event
+	// list restored from it continues with the list that would have
+	// followed, limits included.
+	bool save(ostream& out) const;
+	bool restore(istream& in);
+	// Counters of the underlying search since the cursor was created
+	void get_stats(struct enumeration_stats& stats) const;
+	~event_cursor(void);
+};
 #endif /* EVENT_ITERATOR */
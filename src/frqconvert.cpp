@@ -0,0 +1,29 @@
+#include <iostream>
+#include "loader.hpp"
+
+
+using namespace std;
+
+
+/*
+ * Converts a frequency file of either format to the binary format, which the
+ * mutator maps in place instead of parsing.
+ */
+int main(int argc, char *argv[])
+{
+	frequency_data_loader loader;
+
+	if (argc != 3) {
+		cerr << "Usage: " << argv[0] << " <frequency data file> "
+		     << "<binary output file>\n";
+		return -1;
+	}
+	if (!loader.load_frequency_file(argv[1])) {
+		cerr << "Frequency data missing or corrupt...\n";
+		return -1;
+	}
+	if (!loader.save_binary_file(argv[2]))
+		return -1;
+
+	return 0;
+}
@@ -0,0 +1,129 @@
+#include <iostream>
+#include "generator.hpp"
+
+
+using namespace std;
+
+
+event_list *
+candidate_renderer::build_event_list(const frequency_data_loader& model,
+				     const string& seed)
+{
+	event_list *ev_list;
+	const struct char_table& leading = model.get_leadingchar_table();
+	const struct char_table& normal = model.get_normalchar_table();
+
+	if (seed.empty()) {
+		cerr << __func__ << ": Empty seed...\n";
+		return NULL;
+	}
+	n_events = seed.size();
+	n_events += 1 + 1; // Prefix and suffix events
+	this->seed = seed;
+	prefixes = &model.get_prefix_table();
+	suffixes = &model.get_suffix_table();
+	normal_replacements.clear();
+	ev_list = new event_list(n_events);
+
+	// Prefix events
+	ev_list->set_event_outcomes(0, model.get_prefix_outcomes());
+
+	// Leading character events
+	leadingchar_replacements =
+		leading.chars + leading.row_offsets[(unsigned char)seed[0]];
+	ev_list->set_event_outcomes(1, model.get_leadingchar_outcomes(seed[0]));
+
+	// Normal character events
+	for (int i=1; i<seed.size(); i++) {
+		unsigned char c = seed[i];
+		normal_replacements.push_back(normal.chars +
+					      normal.row_offsets[c]);
+		ev_list->set_event_outcomes(i+1,
+					    model.get_normalchar_outcomes(c));
+	}
+
+	// Suffix events
+	ev_list->set_event_outcomes(n_events-1, model.get_suffix_outcomes());
+
+	return ev_list;
+}
+
+
+void candidate_renderer::render(const vector<int>& outcomes,
+				const char *parts[3], size_t lens[3])
+{
+	int prefix_idx = outcomes[0], suffix_idx = outcomes[n_events-1];
+	seed[0] = leadingchar_replacements[outcomes[1]];
+	for (int i=2; i<n_events-1; i++)
+		seed[i-1] = normal_replacements[i-2][outcomes[i]];
+
+	parts[0] = prefixes->pool + prefixes->offsets[prefix_idx];
+	lens[0] = prefixes->offsets[prefix_idx + 1] -
+		  prefixes->offsets[prefix_idx];
+	parts[1] = seed.data();
+	lens[1] = seed.size();
+	parts[2] = suffixes->pool + suffixes->offsets[suffix_idx];
+	lens[2] = suffixes->offsets[suffix_idx + 1] -
+		  suffixes->offsets[suffix_idx];
+}
+
+
+generator::generator(const frequency_data_loader& model, const string& seed)
+{
+	ev_list.reset(renderer.build_event_list(model, seed));
+}
+
+
+void generator::set_limits(unsigned long long max_candidates,
+			   double min_logprob)
+{
+	if (ev_list)
+		ev_list->set_limits(max_candidates, min_logprob);
+}
+
+
+void generator::start(void)
+{
+	cursor.reset(new event_cursor(*ev_list));
+	outcomes.resize(renderer.n_events);
+}
+
+
+bool generator::next(generated_candidate& candidate)
+{
+	return next_batch(&candidate, 1) == 1;
+}
+
+
+/*
+ * The buffer may move while it grows, texts are pointed into it once the
+ * whole batch is rendered.
+ */
+size_t generator::next_batch(generated_candidate *candidates, size_t n)
+{
+	size_t n_filled = 0;
+	if (!ev_list)
+		return 0;
+	if (!cursor)
+		start();
+
+	buffer.clear();
+	offsets.clear();
+	while (n_filled < n &&
+	       cursor->next(outcomes, candidates[n_filled].logprob)) {
+		const char *parts[3];
+		size_t lens[3];
+		renderer.render(outcomes, parts, lens);
+		offsets.push_back(buffer.size());
+		for (int i=0; i<3; i++)
+			buffer.insert(buffer.end(), parts[i],
+				      parts[i] + lens[i]);
+		n_filled++;
+	}
+	offsets.push_back(buffer.size());
+
+	for (size_t i=0; i<n_filled; i++)
+		candidates[i].text = string_view(buffer.data() + offsets[i],
+						 offsets[i+1] - offsets[i]);
+	return n_filled;
+}
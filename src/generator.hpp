@@ -0,0 +1,84 @@
+#ifndef GENERATOR_H
+#define GENERATOR_H
+
+#include <stddef.h>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "loader.hpp"
+#include "event_iterator.hpp"
+
+
+using namespace std;
+
+
+/*
+ * Turns the outcome lists of a seed's event list into candidate text. Both
+ * only view the loaded model, the event list its sorted sample spaces and
+ * the renderer its string and character tables, so setting up a seed costs
+ * O(seed length). The model must outlive them.
+ */
+class candidate_renderer {
+	public:
+	int n_events;
+	// The seed, with its characters replaced by the last render()
+	string seed;
+	const struct string_table *prefixes, *suffixes;
+	// Replacement characters of every seed position
+	const unsigned char *leadingchar_replacements;
+	vector<const unsigned char*> normal_replacements;
+	// New event list of the seed, whose outcome lists this renders, or
+	// NULL if the seed is empty
+	event_list *build_event_list(const frequency_data_loader& model,
+				     const string& seed);
+	// Prefix, replaced seed and suffix of the candidate
+	void render(const vector<int>& outcomes, const char *parts[3],
+		    size_t lens[3]);
+};
+
+
+struct generated_candidate {
+	string_view text;
+	double logprob;
+};
+
+
+/*
+ * Pull based source of the candidates of one seed, likeliest first. Texts
+ * are rendered into a buffer owned by the generator that is reused from
+ * call to call, so once it has grown nothing is allocated per candidate.
+ * Any number of generators may share one loaded model and be used on any
+ * threads, as long as each generator is used by one thread at a time.
+ */
+class generator {
+	private:
+	candidate_renderer renderer;
+	unique_ptr<event_list> ev_list;
+	// Declared after the list it refers to, so it is destroyed first
+	unique_ptr<event_cursor> cursor;
+	vector<int> outcomes;
+	vector<char> buffer;
+	vector<size_t> offsets;
+	void start(void);
+	public:
+	generator(const frequency_data_loader& model, const string& seed);
+	generator(const generator&) = delete;
+	generator& operator =(const generator&) = delete;
+	// False if the seed was rejected, in which case nothing is generated
+	inline bool ok(void) const
+	{
+		return (bool)ev_list;
+	}
+	// Same meaning as event_list::set_limits, before the first candidate
+	void set_limits(unsigned long long max_candidates, double min_logprob);
+	// False at the end. The text stays valid until the next call to
+	// next() or next_batch().
+	bool next(generated_candidate& candidate);
+	// Fills up to n candidates and returns how many, 0 at the end. The
+	// texts stay valid until the next call to next() or next_batch().
+	size_t next_batch(generated_candidate *candidates, size_t n);
+};
+
+
+#endif /* GENERATOR_H */
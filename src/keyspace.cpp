@@ -0,0 +1,93 @@
+#include <math.h>
+#include <vector>
+#include "event_iterator.hpp"
+
+
+using namespace std;
+
+
+/*
+ * Costs (log-probability drops from the likeliest outcome) are quantized to
+ * bins of C / n_bins, where C is the cost of logprob itself, and the number
+ * of lists per total bin is counted by convolving the bin histograms of the
+ * events one by one. Quantizing every event down moves a list by less than
+ * one bin per event, hence the two bounds:
+ *
+ *   bins of list <= n_bins - n_events  =>  list strictly likelier than logprob
+ *   list at least as likely as logprob  =>  bins of list <= n_bins
+ *
+ * Counts are kept in doubles, keyspaces easily exceed 64 bits.
+ */
+void event_list::count_likelier(double logprob, int n_bins, double& lower,
+				double& upper) const
+{
+	double best_logprob = 0.0, max_cost, bin_width;
+	vector<double> counts, next_counts;
+	vector<int> levels;
+	vector<double> level_counts;
+
+	lower = upper = 0.0;
+	for (int i=0; i<n_events; i++) {
+		if (events[i].empty())
+			return;
+		best_logprob += events[i][0].logarithmic_probability;
+	}
+	max_cost = best_logprob - logprob;
+	if (!(max_cost >= 0))
+		return;
+	if (max_cost == 0) {
+		// Only lists of the likeliest outcomes qualify, none is likelier
+		upper = 1.0;
+		for (int i=0; i<n_events; i++) {
+			size_t n_best = 0;
+			while (n_best < events[i].size() &&
+			       events[i][n_best].logarithmic_probability ==
+			       events[i][0].logarithmic_probability)
+				n_best++;
+			upper *= n_best;
+		}
+		return;
+	}
+	bin_width = max_cost / n_bins;
+
+	counts.assign(n_bins + 1, 0.0);
+	counts[0] = 1.0;
+	for (int i=0; i<n_events; i++) {
+		const outcome_span& event = events[i];
+		double best = event[0].logarithmic_probability;
+
+		// Sparse histogram of the event, outcomes are sorted by cost
+		levels.clear();
+		level_counts.clear();
+		for (const outcome& o : event) {
+			double cost = best - o.logarithmic_probability;
+			double level = floor(cost / bin_width);
+			if (!(level <= n_bins))
+				break;
+			if (levels.empty() || levels.back() != (int)level) {
+				levels.push_back(level);
+				level_counts.push_back(0.0);
+			}
+			level_counts.back() += 1.0;
+		}
+
+		next_counts.assign(n_bins + 1, 0.0);
+		for (int bin=0; bin<=n_bins; bin++) {
+			if (counts[bin] == 0.0)
+				continue;
+			for (size_t j=0; j<levels.size(); j++) {
+				if (bin + levels[j] > n_bins)
+					break;
+				next_counts[bin + levels[j]] +=
+					counts[bin] * level_counts[j];
+			}
+		}
+		counts.swap(next_counts);
+	}
+
+	for (int bin=0; bin<=n_bins; bin++) {
+		if (bin <= n_bins - n_events)
+			lower += counts[bin];
+		upper += counts[bin];
+	}
+}
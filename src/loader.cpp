@@ -4,18 +4,107 @@
 #include <string>
 #include <vector>
 #include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "loader.hpp"
 
 
 using namespace std;
 
 
+static_assert(sizeof(frequency) == sizeof(uint64_t),
+	      "Binary frequency files store 64-bit frequencies");
+static_assert(sizeof(outcome) == 2 * sizeof(uint64_t),
+	      "Binary frequency files store unpadded outcomes");
+
+
+frequency_data_loader::frequency_data_loader(void)
+{
+	mapping = NULL;
+	mapping_size = 0;
+	unload();
+}
+
+
+frequency_data_loader::~frequency_data_loader(void)
+{
+	unload();
+}
+
+
+void
+frequency_data_loader::unload(void)
+{
+	static const uint64_t empty_rows[257] = {0};
+	static const uint64_t empty_offsets[1] = {0};
+
+	if (mapping)
+		munmap(mapping, mapping_size);
+	mapping = NULL;
+	mapping_size = 0;
+	prefix_pool.clear();
+	suffix_pool.clear();
+	prefix_offsets.clear();
+	suffix_offsets.clear();
+	prefix_freqs.clear();
+	suffix_freqs.clear();
+	leading_rows.clear();
+	normal_rows.clear();
+	leading_chars.clear();
+	normal_chars.clear();
+	leading_freqs.clear();
+	normal_freqs.clear();
+	sorted_prefixes.clear();
+	sorted_suffixes.clear();
+	sorted_leading.clear();
+	sorted_normal.clear();
+	prefix_outcomes = suffix_outcomes = NULL;
+	leading_outcomes = normal_outcomes = NULL;
+	prefixes = suffixes = (struct string_table){
+		.n_strings = 0,
+		.freqs = NULL,
+		.offsets = empty_offsets,
+		.pool = NULL,
+	};
+	leading = normal = (struct char_table){
+		.row_offsets = empty_rows,
+		.chars = NULL,
+		.freqs = NULL,
+	};
+}
+
+
+static void
+get_string_frequencies(const struct string_table& table,
+		       vector<string>& strings, vector<frequency>& freqs)
+{
+	strings.clear();
+	for (uint64_t i=0; i<table.n_strings; i++) {
+		uint64_t begin = table.offsets[i], end = table.offsets[i+1];
+		strings.push_back(string(table.pool + begin, end - begin));
+	}
+	freqs.assign(table.freqs, table.freqs + table.n_strings);
+}
+
+
+static void
+get_char_frequencies(const struct char_table& table, unsigned char c,
+		     vector<char>& chars, vector<frequency>& freqs)
+{
+	uint64_t begin = table.row_offsets[c], end = table.row_offsets[c+1];
+	chars.assign(table.chars + begin, table.chars + end);
+	freqs.assign(table.freqs + begin, table.freqs + end);
+}
+
+
 void
 frequency_data_loader::get_prefix_frequencies(vector<string>& prefixes,
 					      vector<frequency>& freqs)
 {
-	prefixes = this->prefix_strings;
-	freqs = this->prefix_frequencies;
+	get_string_frequencies(this->prefixes, prefixes, freqs);
 }
 
 
@@ -24,8 +113,7 @@ frequency_data_loader::get_leadingchar_frequencies(unsigned char leadingchar,
 						   vector<char>& leadingchars,
 						   vector<frequency>& freqs)
 {
-	leadingchars = this->leading_replacement_chars[leadingchar];
-	freqs = this->leading_replacement_frequencies[leadingchar];
+	get_char_frequencies(leading, leadingchar, leadingchars, freqs);
 }
 
 
@@ -34,8 +122,7 @@ frequency_data_loader::get_normalchar_frequencies(unsigned char normalchar,
 						  vector<char>& normalchars,
 						  vector<frequency>& freqs)
 {
-	normalchars = this->normal_replacement_chars[normalchar];
-	freqs = this->normal_replacement_frequencies[normalchar];
+	get_char_frequencies(normal, normalchar, normalchars, freqs);
 }
 
 
@@ -43,13 +130,128 @@ void
 frequency_data_loader::get_suffix_frequencies(vector<string>& suffixes,
 					      vector<frequency>& freqs)
 {
-	suffixes = this->suffix_strings;
-	freqs = this->suffix_frequencies;
+	get_string_frequencies(this->suffixes, suffixes, freqs);
+}
+
+
+const struct string_table&
+frequency_data_loader::get_prefix_table(void) const
+{
+	return prefixes;
+}
+
+
+const struct string_table&
+frequency_data_loader::get_suffix_table(void) const
+{
+	return suffixes;
+}
+
+
+const struct char_table&
+frequency_data_loader::get_leadingchar_table(void) const
+{
+	return leading;
+}
+
+
+const struct char_table&
+frequency_data_loader::get_normalchar_table(void) const
+{
+	return normal;
+}
+
+
+outcome_span
+frequency_data_loader::get_prefix_outcomes(void) const
+{
+	return (outcome_span){prefix_outcomes, prefixes.n_strings};
+}
+
+
+outcome_span
+frequency_data_loader::get_suffix_outcomes(void) const
+{
+	return (outcome_span){suffix_outcomes, suffixes.n_strings};
+}
+
+
+outcome_span
+frequency_data_loader::get_leadingchar_outcomes(unsigned char leadingchar) const
+{
+	uint64_t begin = leading.row_offsets[leadingchar];
+	uint64_t end = leading.row_offsets[leadingchar + 1];
+	return (outcome_span){leading_outcomes + begin, end - begin};
+}
+
+
+outcome_span
+frequency_data_loader::get_normalchar_outcomes(unsigned char normalchar) const
+{
+	uint64_t begin = normal.row_offsets[normalchar];
+	uint64_t end = normal.row_offsets[normalchar + 1];
+	return (outcome_span){normal_outcomes + begin, end - begin};
+}
+
+
+/*
+ * Normalizes and sorts every sample space of a text file once, so that event
+ * lists of any number of seeds only view them. Binary files already hold
+ * them.
+ */
+void
+frequency_data_loader::normalize(void)
+{
+	sorted_prefixes.resize(prefixes.n_strings);
+	normalize_sample_space(prefixes.freqs, prefixes.n_strings,
+			       sorted_prefixes.data());
+	sorted_suffixes.resize(suffixes.n_strings);
+	normalize_sample_space(suffixes.freqs, suffixes.n_strings,
+			       sorted_suffixes.data());
+
+	sorted_leading.resize(leading.row_offsets[256]);
+	sorted_normal.resize(normal.row_offsets[256]);
+	for (int c=0; c<256; c++) {
+		uint64_t begin = leading.row_offsets[c];
+		uint64_t end = leading.row_offsets[c+1];
+		normalize_sample_space(leading.freqs + begin, end - begin,
+				       sorted_leading.data() + begin);
+		begin = normal.row_offsets[c];
+		end = normal.row_offsets[c+1];
+		normalize_sample_space(normal.freqs + begin, end - begin,
+				       sorted_normal.data() + begin);
+	}
+	prefix_outcomes = sorted_prefixes.data();
+	suffix_outcomes = sorted_suffixes.data();
+	leading_outcomes = sorted_leading.data();
+	normal_outcomes = sorted_normal.data();
 }
 
 
 bool
 frequency_data_loader::load_frequency_file(string freqfile_path)
+{
+	char magic[sizeof(FREQFILE_BINARY_MAGIC)] = {0};
+	ifstream input_stream(freqfile_path, ios::binary);
+	if (!input_stream.is_open()) {
+		cerr << "Failed to open file \"" << freqfile_path << "\"\n";
+		return false;
+	}
+	input_stream.read(magic, sizeof magic);
+	input_stream.close();
+
+	unload();
+	if (!memcmp(magic, FREQFILE_BINARY_MAGIC, sizeof magic))
+		return load_binary_file(freqfile_path);
+	if (!load_text_file(freqfile_path))
+		return false;
+	normalize();
+	return true;
+}
+
+
+bool
+frequency_data_loader::load_text_file(string freqfile_path)
 {
 	string section;
 	ifstream input_stream(freqfile_path);
@@ -61,44 +263,89 @@ frequency_data_loader::load_frequency_file(string freqfile_path)
 	bool ret = true;
 	while (input_stream >> section) {
 		if (section == ":prefix:")
-			ret = ret && load_prefix_frequencies(input_stream);
+			ret = ret && load_string_frequencies(input_stream,
+							     prefix_pool,
+							     prefix_offsets,
+							     prefix_freqs);
 		else if (section == ":leading:")
-			ret = ret && load_leadingchar_frequencies(input_stream);
+			ret = ret && load_char_frequencies(input_stream,
+							   leading_rows,
+							   leading_chars,
+							   leading_freqs);
 		else if (section == ":normal:")
-			ret = ret && load_normalchar_frequencies(input_stream);
+			ret = ret && load_char_frequencies(input_stream,
+							   normal_rows,
+							   normal_chars,
+							   normal_freqs);
 		else if (section == ":suffix:")
-			ret = ret && load_suffix_frequencies(input_stream);
+			ret = ret && load_string_frequencies(input_stream,
+							     suffix_pool,
+							     suffix_offsets,
+							     suffix_freqs);
 		else {
 			cerr << "Error: Section \"" << section
 			     << "\" not supported..." << endl;
 			return false;
 		}
 	}
+	if (!ret)
+		return false;
 
-	return ret;
+	if (!prefix_offsets.empty())
+		prefixes = (struct string_table){
+			.n_strings = prefix_freqs.size(),
+			.freqs = prefix_freqs.data(),
+			.offsets = prefix_offsets.data(),
+			.pool = prefix_pool.data(),
+		};
+	if (!suffix_offsets.empty())
+		suffixes = (struct string_table){
+			.n_strings = suffix_freqs.size(),
+			.freqs = suffix_freqs.data(),
+			.offsets = suffix_offsets.data(),
+			.pool = suffix_pool.data(),
+		};
+	if (!leading_rows.empty())
+		leading = (struct char_table){
+			.row_offsets = leading_rows.data(),
+			.chars = leading_chars.data(),
+			.freqs = leading_freqs.data(),
+		};
+	if (!normal_rows.empty())
+		normal = (struct char_table){
+			.row_offsets = normal_rows.data(),
+			.chars = normal_chars.data(),
+			.freqs = normal_freqs.data(),
+		};
+	return true;
 }
 
 
 bool
-frequency_data_loader::load_prefix_frequencies(ifstream& input_stream)
+frequency_data_loader::load_string_frequencies(ifstream& input_stream,
+					       vector<char>& pool,
+					       vector<uint64_t>& offsets,
+					       vector<frequency>& freqs)
 {
 	string tag;
 	int n_items;
-	vector<string> items;
-	vector<frequency> freqs;
 
+	pool.clear();
+	offsets.assign(1, 0);
+	freqs.clear();
 	if (!(input_stream >> tag >> n_items) || tag != "START") {
 		cerr << __func__ << ": Corrupt start tag...\n";
 		return false;
 	}
 	for (int i=0; i<n_items; i++) {
-		string prefix;
+		string item;
 		frequency freq;
-		if (!(input_stream >> prefix)) {
-			cerr << __func__ << ": Corrupt entry prefix...\n";
+		if (!(input_stream >> item)) {
+			cerr << __func__ << ": Corrupt entry string...\n";
 			return false;
 		}
-		items.push_back(prefix.substr(1));
+		pool.insert(pool.end(), item.begin() + 1, item.end());
+		offsets.push_back(pool.size());
 		if (!(input_stream >> freq)) {
 			cerr << __func__ << ": Corrupt entry frequency...\n";
 			return false;
@@ -110,8 +357,6 @@ frequency_data_loader::load_prefix_frequencies(ifstream& input_stream)
 		return false;
 	}
 
-	prefix_strings = items;
-	prefix_frequencies = freqs;
 	return true;
 }
 
@@ -129,7 +374,7 @@ stol(string num)
 
 
 static bool
-read_char_freq_line(ifstream& input_stream, vector<char>& chars,
+read_char_freq_line(ifstream& input_stream, vector<unsigned char>& chars,
 		    vector<frequency>& freqs)
 {
 	int n_pairs;
@@ -152,7 +397,7 @@ read_char_freq_line(ifstream& input_stream, vector<char>& chars,
 		}
 		repchar = (unsigned char)(int)stoi(pair.substr(0, delim_idx));
 		repfreq = (frequency)stol(pair.substr(delim_idx + 1));
-		chars.push_back((char)repchar);
+		chars.push_back(repchar);
 		freqs.push_back(repfreq);
 	}
 
@@ -161,11 +406,17 @@ read_char_freq_line(ifstream& input_stream, vector<char>& chars,
 
 
 bool
-frequency_data_loader::load_leadingchar_frequencies(ifstream& input_stream)
+frequency_data_loader::load_char_frequencies(ifstream& input_stream,
+					     vector<uint64_t>& rows,
+					     vector<unsigned char>& chars,
+					     vector<frequency>& freqs)
 {
 	string tag;
 	int n_items;
 
+	rows.assign(1, 0);
+	chars.clear();
+	freqs.clear();
 	if (!(input_stream >> tag >> n_items)) {
 		cerr << __func__ << ": Corrupt start tag...\n";
 		return false;
@@ -176,11 +427,8 @@ frequency_data_loader::load_leadingchar_frequencies(ifstream& input_stream)
 	}
 
 	for (int i=0; i<n_items; i++) {
-		vector<char> chars;
-		vector<frequency> freqs;
 		read_char_freq_line(input_stream, chars, freqs);
-		leading_replacement_chars[i] = chars;
-		leading_replacement_frequencies[i] = freqs;
+		rows.push_back(chars.size());
 	}
 	if (!(input_stream >> tag) || tag != "END") {
 		cerr << __func__ << ": Corrupt end tag...\n";
@@ -191,69 +439,278 @@ frequency_data_loader::load_leadingchar_frequencies(ifstream& input_stream)
 }
 
 
+/* True if count elements of elem_size bytes at offset lie within the file */
+static bool
+section_fits(uint64_t offset, uint64_t count, uint64_t elem_size,
+	     uint64_t file_size)
+{
+	if (offset % sizeof(uint64_t) || offset > file_size)
+		return false;
+	return count <= (file_size - offset) / elem_size;
+}
+
+
+/*
+ * True if every row of outcomes, rows[0..n_rows] apart, identifies outcomes
+ * within its row
+ */
+static bool
+outcomes_valid(const outcome *outcomes, const uint64_t *rows, int n_rows)
+{
+	for (int row=0; row<n_rows; row++)
+		for (uint64_t i=rows[row]; i<rows[row+1]; i++)
+			if (outcomes[i].identifier < 0 ||
+			    (uint64_t)outcomes[i].identifier >=
+			    rows[row+1] - rows[row])
+				return false;
+	return true;
+}
+
+
+/* True if offsets[0..count] ascend from 0 to end */
+static bool
+offsets_valid(const uint64_t *offsets, uint64_t count, uint64_t end)
+{
+	if (offsets[0] != 0 || offsets[count] != end)
+		return false;
+	for (uint64_t i=0; i<count; i++)
+		if (offsets[i] > offsets[i+1])
+			return false;
+	return true;
+}
+
+
 bool
-frequency_data_loader::load_normalchar_frequencies(ifstream& input_stream)
+frequency_data_loader::load_binary_file(string freqfile_path)
 {
-	string tag;
-	int n_items;
+	int fd;
+	struct stat st;
+	const char *base;
+	const struct freqfile_header *hdr;
+	uint64_t size, prefix_bounds[2], suffix_bounds[2];
 
-	if (!(input_stream >> tag >> n_items)) {
-		cerr << __func__ << ": Corrupt start tag...\n";
+	if ((fd = open(freqfile_path.c_str(), O_RDONLY)) < 0) {
+		cerr << "Failed to open file \"" << freqfile_path << "\"\n";
 		return false;
 	}
-	if (tag != "START" || n_items != 256) {
-		cerr << __func__ << ": Corrupt start tag...\n";
+	if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof *hdr) {
+		cerr << __func__ << ": Truncated header...\n";
+		close(fd);
+		return false;
+	}
+	mapping = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (mapping == MAP_FAILED) {
+		mapping = NULL;
+		cerr << __func__ << ": Failed to map file...\n";
 		return false;
 	}
+	mapping_size = st.st_size;
+	base = (const char*)mapping;
+	hdr = (const struct freqfile_header*)base;
+	size = mapping_size;
+
+	if (hdr->version != FREQFILE_BINARY_VERSION ||
+	    hdr->byte_order != FREQFILE_BYTE_ORDER_MARK) {
+		cerr << __func__ << ": Unsupported version or byte order...\n";
+		goto corrupt;
+	}
+	if (hdr->file_size != size ||
+	    !section_fits(hdr->prefix_freqs, hdr->n_prefixes,
+			  sizeof(frequency), size) ||
+	    !section_fits(hdr->prefix_offsets, hdr->n_prefixes + 1,
+			  sizeof(uint64_t), size) ||
+	    !section_fits(hdr->prefix_pool, hdr->prefix_pool_size, 1, size) ||
+	    !section_fits(hdr->suffix_freqs, hdr->n_suffixes,
+			  sizeof(frequency), size) ||
+	    !section_fits(hdr->suffix_offsets, hdr->n_suffixes + 1,
+			  sizeof(uint64_t), size) ||
+	    !section_fits(hdr->suffix_pool, hdr->suffix_pool_size, 1, size) ||
+	    !section_fits(hdr->leading_rows, 257, sizeof(uint64_t), size) ||
+	    !section_fits(hdr->leading_chars, hdr->n_leading, 1, size) ||
+	    !section_fits(hdr->leading_freqs, hdr->n_leading,
+			  sizeof(frequency), size) ||
+	    !section_fits(hdr->normal_rows, 257, sizeof(uint64_t), size) ||
+	    !section_fits(hdr->normal_chars, hdr->n_normal, 1, size) ||
+	    !section_fits(hdr->normal_freqs, hdr->n_normal,
+			  sizeof(frequency), size) ||
+	    !section_fits(hdr->prefix_outcomes, hdr->n_prefixes,
+			  sizeof(outcome), size) ||
+	    !section_fits(hdr->suffix_outcomes, hdr->n_suffixes,
+			  sizeof(outcome), size) ||
+	    !section_fits(hdr->leading_outcomes, hdr->n_leading,
+			  sizeof(outcome), size) ||
+	    !section_fits(hdr->normal_outcomes, hdr->n_normal,
+			  sizeof(outcome), size)) {
+		cerr << __func__ << ": Section out of bounds...\n";
+		goto corrupt;
+	}
 
-	for (int i=0; i<n_items; i++) {
-		vector<char> chars;
-		vector<frequency> freqs;
-		read_char_freq_line(input_stream, chars, freqs);
-		normal_replacement_chars[i] = chars;
-		normal_replacement_frequencies[i] = freqs;
+	prefixes = (struct string_table){
+		.n_strings = hdr->n_prefixes,
+		.freqs = (const frequency*)(base + hdr->prefix_freqs),
+		.offsets = (const uint64_t*)(base + hdr->prefix_offsets),
+		.pool = base + hdr->prefix_pool,
+	};
+	suffixes = (struct string_table){
+		.n_strings = hdr->n_suffixes,
+		.freqs = (const frequency*)(base + hdr->suffix_freqs),
+		.offsets = (const uint64_t*)(base + hdr->suffix_offsets),
+		.pool = base + hdr->suffix_pool,
+	};
+	leading = (struct char_table){
+		.row_offsets = (const uint64_t*)(base + hdr->leading_rows),
+		.chars = (const unsigned char*)(base + hdr->leading_chars),
+		.freqs = (const frequency*)(base + hdr->leading_freqs),
+	};
+	normal = (struct char_table){
+		.row_offsets = (const uint64_t*)(base + hdr->normal_rows),
+		.chars = (const unsigned char*)(base + hdr->normal_chars),
+		.freqs = (const frequency*)(base + hdr->normal_freqs),
+	};
+	if (!offsets_valid(prefixes.offsets, hdr->n_prefixes,
+			   hdr->prefix_pool_size) ||
+	    !offsets_valid(suffixes.offsets, hdr->n_suffixes,
+			   hdr->suffix_pool_size) ||
+	    !offsets_valid(leading.row_offsets, 256, hdr->n_leading) ||
+	    !offsets_valid(normal.row_offsets, 256, hdr->n_normal)) {
+		cerr << __func__ << ": Corrupt offset table...\n";
+		goto corrupt;
 	}
-	if (!(input_stream >> tag) || tag != "END") {
-		cerr << __func__ << ": Corrupt end tag...\n";
-		return false;
+
+	prefix_bounds[0] = suffix_bounds[0] = 0;
+	prefix_bounds[1] = hdr->n_prefixes;
+	suffix_bounds[1] = hdr->n_suffixes;
+	prefix_outcomes = (const outcome*)(base + hdr->prefix_outcomes);
+	suffix_outcomes = (const outcome*)(base + hdr->suffix_outcomes);
+	leading_outcomes = (const outcome*)(base + hdr->leading_outcomes);
+	normal_outcomes = (const outcome*)(base + hdr->normal_outcomes);
+	if (!outcomes_valid(prefix_outcomes, prefix_bounds, 1) ||
+	    !outcomes_valid(suffix_outcomes, suffix_bounds, 1) ||
+	    !outcomes_valid(leading_outcomes, leading.row_offsets, 256) ||
+	    !outcomes_valid(normal_outcomes, normal.row_offsets, 256)) {
+		cerr << __func__ << ": Corrupt sample space...\n";
+		goto corrupt;
 	}
 
 	return true;
+ corrupt:
+	unload();
+	return false;
 }
 
 
-bool
-frequency_data_loader::load_suffix_frequencies(ifstream& input_stream)
+/* Appends count elements of elem_size bytes, padded to 8 bytes */
+static uint64_t
+place_section(uint64_t& file_size, uint64_t count, uint64_t elem_size)
 {
-	string tag;
-	int n_items;
-	vector<string> items;
-	vector<frequency> freqs;
+	uint64_t offset = file_size;
+	file_size += count * elem_size;
+	file_size = (file_size + 7) / 8 * 8;
+	return offset;
+}
 
-	if (!(input_stream >> tag >> n_items) || tag != "START") {
-		cerr << __func__ << ": Corrupt start tag...\n";
+
+static void
+write_section(ofstream& output_stream, uint64_t offset, const void *data,
+	      uint64_t size)
+{
+	static const char padding[8] = {0};
+	uint64_t position = output_stream.tellp();
+	output_stream.write(padding, offset - position);
+	output_stream.write((const char*)data, size);
+}
+
+
+bool
+frequency_data_loader::save_binary_file(string freqfile_path)
+{
+	struct freqfile_header hdr;
+	uint64_t file_size = 0;
+	ofstream output_stream(freqfile_path, ios::binary | ios::trunc);
+	if (!output_stream.is_open()) {
+		cerr << "Failed to open file \"" << freqfile_path << "\"\n";
 		return false;
 	}
-	for (int i=0; i<n_items; i++) {
-		string suffix;
-		frequency freq;
-		if (!(input_stream >> suffix)) {
-			cerr << __func__ << ": Corrupt entry prefix...\n";
-			return false;
-		}
-		items.push_back(suffix.substr(1));
-		if (!(input_stream >> freq)) {
-			cerr << __func__ << ": Corrupt entry frequency...\n";
-			return false;
-		}
-		freqs.push_back(freq);
-	}
-	if (!(input_stream >> tag) || tag != "END") {
-		cerr << __func__ << ": Corrupt end tag...\n";
+
+	memset(&hdr, 0, sizeof hdr);
+	memcpy(hdr.magic, FREQFILE_BINARY_MAGIC, sizeof hdr.magic);
+	hdr.version = FREQFILE_BINARY_VERSION;
+	hdr.byte_order = FREQFILE_BYTE_ORDER_MARK;
+	hdr.n_prefixes = prefixes.n_strings;
+	hdr.n_suffixes = suffixes.n_strings;
+	hdr.prefix_pool_size = prefixes.offsets[prefixes.n_strings];
+	hdr.suffix_pool_size = suffixes.offsets[suffixes.n_strings];
+	hdr.n_leading = leading.row_offsets[256];
+	hdr.n_normal = normal.row_offsets[256];
+
+	place_section(file_size, 1, sizeof hdr);
+	hdr.prefix_freqs = place_section(file_size, hdr.n_prefixes,
+					 sizeof(frequency));
+	hdr.prefix_offsets = place_section(file_size, hdr.n_prefixes + 1,
+					   sizeof(uint64_t));
+	hdr.suffix_freqs = place_section(file_size, hdr.n_suffixes,
+					 sizeof(frequency));
+	hdr.suffix_offsets = place_section(file_size, hdr.n_suffixes + 1,
+					   sizeof(uint64_t));
+	hdr.leading_rows = place_section(file_size, 257, sizeof(uint64_t));
+	hdr.leading_freqs = place_section(file_size, hdr.n_leading,
+					  sizeof(frequency));
+	hdr.normal_rows = place_section(file_size, 257, sizeof(uint64_t));
+	hdr.normal_freqs = place_section(file_size, hdr.n_normal,
+					 sizeof(frequency));
+	hdr.prefix_outcomes = place_section(file_size, hdr.n_prefixes,
+					    sizeof(outcome));
+	hdr.suffix_outcomes = place_section(file_size, hdr.n_suffixes,
+					    sizeof(outcome));
+	hdr.leading_outcomes = place_section(file_size, hdr.n_leading,
+					     sizeof(outcome));
+	hdr.normal_outcomes = place_section(file_size, hdr.n_normal,
+					    sizeof(outcome));
+	hdr.leading_chars = place_section(file_size, hdr.n_leading, 1);
+	hdr.normal_chars = place_section(file_size, hdr.n_normal, 1);
+	hdr.prefix_pool = place_section(file_size, hdr.prefix_pool_size, 1);
+	hdr.suffix_pool = place_section(file_size, hdr.suffix_pool_size, 1);
+	hdr.file_size = file_size;
+
+	write_section(output_stream, 0, &hdr, sizeof hdr);
+	write_section(output_stream, hdr.prefix_freqs, prefixes.freqs,
+		      hdr.n_prefixes * sizeof(frequency));
+	write_section(output_stream, hdr.prefix_offsets, prefixes.offsets,
+		      (hdr.n_prefixes + 1) * sizeof(uint64_t));
+	write_section(output_stream, hdr.suffix_freqs, suffixes.freqs,
+		      hdr.n_suffixes * sizeof(frequency));
+	write_section(output_stream, hdr.suffix_offsets, suffixes.offsets,
+		      (hdr.n_suffixes + 1) * sizeof(uint64_t));
+	write_section(output_stream, hdr.leading_rows, leading.row_offsets,
+		      257 * sizeof(uint64_t));
+	write_section(output_stream, hdr.leading_freqs, leading.freqs,
+		      hdr.n_leading * sizeof(frequency));
+	write_section(output_stream, hdr.normal_rows, normal.row_offsets,
+		      257 * sizeof(uint64_t));
+	write_section(output_stream, hdr.normal_freqs, normal.freqs,
+		      hdr.n_normal * sizeof(frequency));
+	write_section(output_stream, hdr.prefix_outcomes, prefix_outcomes,
+		      hdr.n_prefixes * sizeof(outcome));
+	write_section(output_stream, hdr.suffix_outcomes, suffix_outcomes,
+		      hdr.n_suffixes * sizeof(outcome));
+	write_section(output_stream, hdr.leading_outcomes, leading_outcomes,
+		      hdr.n_leading * sizeof(outcome));
+	write_section(output_stream, hdr.normal_outcomes, normal_outcomes,
+		      hdr.n_normal * sizeof(outcome));
+	write_section(output_stream, hdr.leading_chars, leading.chars,
+		      hdr.n_leading);
+	write_section(output_stream, hdr.normal_chars, normal.chars,
+		      hdr.n_normal);
+	write_section(output_stream, hdr.prefix_pool, prefixes.pool,
+		      hdr.prefix_pool_size);
+	write_section(output_stream, hdr.suffix_pool, suffixes.pool,
+		      hdr.suffix_pool_size);
+	write_section(output_stream, hdr.file_size, NULL, 0);
+
+	if (!output_stream.good()) {
+		cerr << "Failed to write file \"" << freqfile_path << "\"\n";
 		return false;
 	}
-
-	this->suffix_strings = items;
-	this->suffix_frequencies = freqs;
 	return true;
 }
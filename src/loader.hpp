@@ -1,10 +1,17 @@
 #ifndef LOADER_H
 #define LOADER_H
 
+#include <stdint.h>
 #include <iostream>
 #include <fstream>
 #include <string>
 #include <vector>
+#include "event_iterator.hpp"
+
+// First bytes of a binary frequency file, the text format starts with ':'
+#define FREQFILE_BINARY_MAGIC "MUTFRQB"
+#define FREQFILE_BINARY_VERSION 2
+#define FREQFILE_BYTE_ORDER_MARK 0x01020304
 
 
 using namespace std;
@@ -13,29 +20,98 @@ using namespace std;
 typedef unsigned long long frequency;
 
 
+/*
+ * Strings and their frequencies. String i is pool[offsets[i]] up to
+ * pool[offsets[i+1]], strings are not NUL terminated.
+ */
+struct string_table {
+	uint64_t n_strings;
+	const frequency *freqs;
+	const uint64_t *offsets;
+	const char *pool;
+};
+
+
+/*
+ * 256 rows of replacement characters and their frequencies. The entries of
+ * row c are chars[row_offsets[c]] up to chars[row_offsets[c+1]].
+ */
+struct char_table {
+	const uint64_t *row_offsets;
+	const unsigned char *chars;
+	const frequency *freqs;
+};
+
+
+/*
+ * Layout of a binary frequency file. The header is followed by the arrays it
+ * points at, each at an offset aligned to 8 bytes from the start of the file
+ * and stored in host byte order, so the file is used in place once mapped.
+ * Sample spaces are stored normalized and sorted as well, laid out like the
+ * frequencies they were computed from.
+ */
+struct freqfile_header {
+	char magic[8];
+	uint32_t version;
+	// FREQFILE_BYTE_ORDER_MARK as written by the host that made the file
+	uint32_t byte_order;
+	uint64_t n_prefixes, n_suffixes;
+	uint64_t prefix_pool_size, suffix_pool_size;
+	uint64_t n_leading, n_normal;
+	// Offsets from the start of the file
+	uint64_t prefix_freqs, prefix_offsets, prefix_pool;
+	uint64_t suffix_freqs, suffix_offsets, suffix_pool;
+	uint64_t leading_rows, leading_chars, leading_freqs;
+	uint64_t normal_rows, normal_chars, normal_freqs;
+	uint64_t prefix_outcomes, suffix_outcomes;
+	uint64_t leading_outcomes, normal_outcomes;
+	uint64_t file_size;
+};
+
+
 class frequency_data_loader {
 	private:
-	// Vectors of prefixes and their frequencies
-	vector<string> prefix_strings;
-	vector<frequency> prefix_frequencies;
-	// 256 vectors of possible leading character replacements and 256
-	// vectors of their corresponding frequencies
-	vector<char> leading_replacement_chars[256];
-	vector<frequency> leading_replacement_frequencies[256];
-	// 256 vectors of possible non-leading character replacements and 256
-	// vectors of their corresponding frequencies
-	vector<char> normal_replacement_chars[256];
-	vector<frequency> normal_replacement_frequencies[256];
-	// Vectors of suffixes and their frequencies
-	vector<string> suffix_strings;
-	vector<frequency> suffix_frequencies;
+	// Views of the loaded data, pointing either into the storage below
+	// (text files) or into the mapped file (binary files)
+	struct string_table prefixes, suffixes;
+	struct char_table leading, normal;
+	// Storage of data parsed from a text file
+	vector<char> prefix_pool, suffix_pool;
+	vector<uint64_t> prefix_offsets, suffix_offsets;
+	vector<frequency> prefix_freqs, suffix_freqs;
+	vector<uint64_t> leading_rows, normal_rows;
+	vector<unsigned char> leading_chars, normal_chars;
+	vector<frequency> leading_freqs, normal_freqs;
+	// Mapping of a binary file
+	void *mapping;
+	size_t mapping_size;
+	// Normalized and sorted sample spaces laid out like the views above,
+	// either in the storage below or in the mapped file
+	const outcome *prefix_outcomes, *suffix_outcomes;
+	const outcome *leading_outcomes, *normal_outcomes;
+	vector<outcome> sorted_prefixes, sorted_suffixes;
+	vector<outcome> sorted_leading, sorted_normal;
+	void normalize(void);
 	// Loaders:
-	bool load_prefix_frequencies(ifstream& input_stream);
-	bool load_leadingchar_frequencies(ifstream& input_stream);
-	bool load_normalchar_frequencies(ifstream& input_stream);
-	bool load_suffix_frequencies(ifstream& input_stream);
+	bool load_text_file(string freqfile_path);
+	bool load_binary_file(string freqfile_path);
+	bool load_string_frequencies(ifstream& input_stream, vector<char>& pool,
+				     vector<uint64_t>& offsets,
+				     vector<frequency>& freqs);
+	bool load_char_frequencies(ifstream& input_stream,
+				   vector<uint64_t>& rows,
+				   vector<unsigned char>& chars,
+				   vector<frequency>& freqs);
+	void unload(void);
 	public:
+	frequency_data_loader(void);
+	frequency_data_loader(const frequency_data_loader&) = delete;
+	frequency_data_loader& operator =(const frequency_data_loader&) =
+		delete;
+	/* Loads either format, telling them apart by the binary magic */
 	bool load_frequency_file(string freqfile_path);
+	/* Writes the loaded data as a binary frequency file */
+	bool save_binary_file(string freqfile_path);
 	void get_prefix_frequencies(vector<string>& prefixes,
 				    vector<frequency>& freqs);
 	void get_leadingchar_frequencies(unsigned char leadingchar,
@@ -46,6 +122,17 @@ class frequency_data_loader {
 					vector<frequency>& freqs);
 	void get_suffix_frequencies(vector<string>& suffixes,
 				    vector<frequency>& freqs);
+	// Views of the loaded data, valid until the next load. Outcome
+	// identifiers index the strings or characters of the matching table.
+	const struct string_table& get_prefix_table(void) const;
+	const struct string_table& get_suffix_table(void) const;
+	const struct char_table& get_leadingchar_table(void) const;
+	const struct char_table& get_normalchar_table(void) const;
+	outcome_span get_prefix_outcomes(void) const;
+	outcome_span get_suffix_outcomes(void) const;
+	outcome_span get_leadingchar_outcomes(unsigned char leadingchar) const;
+	outcome_span get_normalchar_outcomes(unsigned char normalchar) const;
+	~frequency_data_loader(void);
 };
 
 
@@ -1,11 +1,38 @@
 #include <vector>
 #include <string>
 #include <cstring>
+#include <cmath>
 #include <iostream>
+#include <fstream>
+#include <memory>
+#include <queue>
+#include <chrono>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
 #include "loader.hpp"
 #include "event_iterator.hpp"
+#include "output_writer.hpp"
+#include "shard_merge.hpp"
+#include "dedupe.hpp"
+#include "generator.hpp"
 
 #define FREQDATA_DEFAULT_PATH ((char*)("/usr/share/mutator/mt_freqdata.frq"))
+#define CHECKPOINT_MAGIC "MUTCKPT"
+#define CHECKPOINT_VERSION 1
+#define CHECKPOINT_DEFAULT_INTERVAL 60
+// Candidates between looks at the checkpoint clock
+#define CHECKPOINT_CHECK_PERIOD 4096
+// Resolution of keyspace counts and ranks
+#define KEYSPACE_BINS 4096
+// Microseconds between looks at the clock for statistics and the time budget
+#define MONITOR_TICK_USEC 100000
 
 
 using namespace std;
@@ -14,16 +41,188 @@ using namespace std;
 typedef unsigned long long frequency;
 
 
+/*
+ * Progress of a run for --stats and --time-budget. Statistics go to stderr
+ * every interval seconds (never if 0), on SIGUSR1 and at the end of the run.
+ * The clock is only read when SIGALRM, raised every MONITOR_TICK_USEC, asks
+ * for it, so the run can check at every step whatever the step costs.
+ */
+struct run_monitor {
+	chrono::steady_clock::time_point start, next_report, deadline;
+	bool report, budgeted, out_of_time;
+	unsigned long interval;
+	// Log-probability of the last candidate, where the search stands
+	double logprob;
+	const candidate_writer *writer;
+	// Searches to report on, none for threaded and banded runs, and the
+	// final counters of those that are over
+	vector<const event_cursor*> cursors;
+	struct enumeration_stats retired;
+	bool searched;
+};
+
+
 struct ev_data {
-	char *seed;
-	int n_events;
-	vector<string> prefixes, suffixes;
-	vector<char> leadingchar_replacements;
-	vector<vector<char>> normal_replacements;
+	candidate_renderer renderer;
+	candidate_writer *writer;
+	// Natural log of the seed weight, added to every candidate's score
+	double log_prior;
+	struct run_monitor *monitor;
 };
 
 
-static void event_iteration_cb(const vector<int>& outcomes, void *cb_data)
+static volatile sig_atomic_t stats_requested = 0, check_requested = 0;
+
+
+static void request_stats(int)
+{
+	stats_requested = 1;
+}
+
+
+static void request_check(int)
+{
+	check_requested = 1;
+}
+
+
+/* Resident set size and its high-water mark in KiB */
+static void memory_usage(unsigned long& rss, unsigned long& peak_rss)
+{
+	string line;
+	ifstream status("/proc/self/status");
+	rss = peak_rss = 0;
+	while (getline(status, line))
+		if (!line.compare(0, 6, "VmRSS:"))
+			rss = strtoul(line.c_str() + 6, NULL, 10);
+		else if (!line.compare(0, 6, "VmHWM:"))
+			peak_rss = strtoul(line.c_str() + 6, NULL, 10);
+}
+
+
+static void add_stats(struct enumeration_stats& total,
+		      const event_cursor *cursor)
+{
+	struct enumeration_stats stats;
+	cursor->get_stats(stats);
+	total.nodes_expanded += stats.nodes_expanded;
+	total.successors_generated += stats.successors_generated;
+	total.successors_deduplicated += stats.successors_deduplicated;
+	total.successors_pruned += stats.successors_pruned;
+	total.nodes_trimmed += stats.nodes_trimmed;
+	total.frontier_size += stats.frontier_size;
+	total.frontier_peak += stats.frontier_peak;
+	total.enqueued_size += stats.enqueued_size;
+}
+
+
+static void watch_cursor(struct run_monitor *monitor,
+			 const event_cursor *cursor)
+{
+	monitor->cursors.push_back(cursor);
+	monitor->searched = true;
+}
+
+
+/* Keeps the counters of cursors about to be destroyed */
+static void retire_cursors(struct run_monitor *monitor)
+{
+	for (const event_cursor *cursor : monitor->cursors)
+		add_stats(monitor->retired, cursor);
+	monitor->cursors.clear();
+}
+
+
+static void print_stats(const struct run_monitor *monitor)
+{
+	double elapsed = chrono::duration<double>(chrono::steady_clock::now() -
+						  monitor->start).count();
+	struct enumeration_stats total = monitor->retired;
+	unsigned long rss, peak_rss;
+
+	for (const event_cursor *cursor : monitor->cursors)
+		add_stats(total, cursor);
+	memory_usage(rss, peak_rss);
+
+	fprintf(stderr, "stats: %.1f s, %llu candidates (%.0f/s), logprob "
+		"%.6g, %llu bytes written, RSS %lu KiB (peak %lu KiB)\n",
+		elapsed, monitor->writer->candidates_written(),
+		elapsed > 0 ? monitor->writer->candidates_written() / elapsed
+			    : 0.0,
+		monitor->logprob, monitor->writer->written(), rss, peak_rss);
+	if (!monitor->searched)
+		return;
+	fprintf(stderr, "stats: frontier %llu (peak %llu), enqueued set "
+		"%llu, expanded %llu, successors %llu (%llu deduplicated, "
+		"%llu pruned), trimmed %llu\n",
+		total.frontier_size, total.frontier_peak, total.enqueued_size,
+		total.nodes_expanded, total.successors_generated,
+		total.successors_deduplicated, total.successors_pruned,
+		total.nodes_trimmed);
+}
+
+
+/* Reports if due, false once the time budget is spent */
+static bool monitor_check(struct run_monitor *monitor)
+{
+	chrono::steady_clock::time_point now;
+
+	if (!check_requested && !stats_requested)
+		return !monitor->out_of_time;
+	check_requested = 0;
+	now = chrono::steady_clock::now();
+	if (stats_requested ||
+	    (monitor->interval && now >= monitor->next_report)) {
+		stats_requested = 0;
+		print_stats(monitor);
+		monitor->next_report = now +
+				       chrono::seconds(monitor->interval);
+	}
+	if (monitor->budgeted && now >= monitor->deadline) {
+		monitor->out_of_time = true;
+		return false;
+	}
+	return true;
+}
+
+
+/*
+ * Accounts for a candidate handed to the writer, which may have dropped it as
+ * a duplicate. Every cursor step visits one node and ends here, so the budget
+ * is checked however few candidates are written.
+ */
+static bool monitor_candidate(struct run_monitor *monitor, double logprob)
+{
+	monitor->logprob = logprob;
+	return monitor_check(monitor);
+}
+
+
+// A seed of a batch run along with its next candidate
+struct batch_seed {
+	struct ev_data data;
+	unique_ptr<event_list> ev_list;
+	unique_ptr<event_cursor> cursor;
+	vector<int> outcomes;
+	double logprob;
+};
+
+
+struct batch_head {
+	double score;
+	size_t seed_idx;
+	inline bool operator <(const batch_head& rhs) const
+	{
+		// Best score on top, earlier seed first on ties
+		if (score == rhs.score)
+			return seed_idx > rhs.seed_idx;
+		return score < rhs.score;
+	}
+};
+
+
+static bool event_iteration_cb(const vector<int>& outcomes, double logprob,
+			       void *cb_data)
 {
 #if 0
 	cout << "Got outcomes in event iteration:";
@@ -32,87 +231,806 @@ static void event_iteration_cb(const vector<int>& outcomes, void *cb_data)
 	cout << "\n";
 #endif
 	struct ev_data *data = (struct ev_data*)cb_data;
-	data->seed[0] = data->leadingchar_replacements[outcomes[1]];
-	for (int i=2; i<data->n_events-1; i++)
-		data->seed[i-1] = data->normal_replacements[i-2][outcomes[i]];
-	cout << data->prefixes[outcomes[0]];
-	cout << data->seed;
-	cout << data->suffixes[outcomes[data->n_events-1]] << endl;
+	const char *parts[3];
+	size_t lens[3];
+	data->renderer.render(outcomes, parts, lens);
+	if (!data->writer->write_candidate(parts, lens, 3,
+					   logprob + data->log_prior))
+		return false;
+	return !data->monitor ||
+	       monitor_candidate(data->monitor, logprob + data->log_prior);
+}
+
+
+static event_list *build_event_list(const frequency_data_loader& loader,
+				    const string& seed, struct ev_data *data)
+{
+	data->log_prior = 0.0;
+	data->monitor = NULL;
+	return data->renderer.build_event_list(loader, seed);
+}
+
+
+/*
+ * Seeds are read one per line, optionally followed by a tab and a positive
+ * weight. Every seed gets its own event list and cursor, and the cursors are
+ * merged on candidate log-probability plus the log of the seed weight.
+ */
+static int run_batch(const frequency_data_loader& loader,
+		     istream& seed_stream, candidate_writer& writer,
+		     unsigned long long limit, double min_logprob,
+		     struct run_monitor *monitor)
+{
+	string line;
+	vector<unique_ptr<struct batch_seed>> seeds;
+	priority_queue<batch_head> heads;
+	unsigned long long n_emitted = 0;
+
+	for (int line_no=1; getline(seed_stream, line); line_no++) {
+		size_t tab = line.find('\t');
+		double weight = 1.0;
+		struct batch_seed *bs;
+		if (tab != string::npos) {
+			const char *weight_str = line.c_str() + tab + 1;
+			char *end;
+			weight = strtod(weight_str, &end);
+			if (*weight_str == '\0' || *end != '\0' ||
+			    !(weight > 0)) {
+				cerr << "Invalid seed weight on line "
+				     << line_no << "\n";
+				return -1;
+			}
+			line.resize(tab);
+		}
+		if (line.empty())
+			continue;
+
+		bs = new struct batch_seed;
+		seeds.push_back(unique_ptr<struct batch_seed>(bs));
+		bs->ev_list.reset(build_event_list(loader, line, &bs->data));
+		bs->data.writer = &writer;
+		bs->data.log_prior = log(weight);
+		bs->data.monitor = monitor;
+		bs->ev_list->set_limits(limit, min_logprob - bs->data.log_prior);
+		bs->cursor.reset(new event_cursor(*bs->ev_list));
+		if (monitor)
+			watch_cursor(monitor, bs->cursor.get());
+		// Setting up many seeds takes time of its own
+		if (monitor && !monitor_check(monitor))
+			break;
+		if (bs->cursor->next(bs->outcomes, bs->logprob))
+			heads.push((batch_head){
+				bs->logprob + bs->data.log_prior,
+				seeds.size() - 1,
+			});
+	}
+
+	// Nothing more is written once seed setup spent the budget
+	while (!heads.empty() && !(monitor && monitor->out_of_time)) {
+		struct batch_seed *bs = seeds[heads.top().seed_idx].get();
+		size_t seed_idx = heads.top().seed_idx;
+		heads.pop();
+		if (!event_iteration_cb(bs->outcomes, bs->logprob, &bs->data))
+			break;
+		if (limit && ++n_emitted == limit)
+			break;
+		if (bs->cursor->next(bs->outcomes, bs->logprob))
+			heads.push((batch_head){
+				bs->logprob + bs->data.log_prior,
+				seed_idx,
+			});
+	}
+
+	if (monitor)
+		retire_cursors(monitor);
+	return 0;
+}
+
+
+// Followed by the seed and the saved event cursor
+struct checkpoint_header {
+	char magic[8];
+	uint32_t version, seed_len;
+	uint64_t n_emitted;
+	// Bytes of output written up to the checkpoint
+	uint64_t output_bytes;
+};
+
+
+/* Written to a temporary file first, so a crash keeps the last checkpoint */
+static bool save_checkpoint(const string& path, const string& seed,
+			    const event_cursor& cursor, uint64_t n_emitted,
+			    uint64_t output_bytes)
+{
+	struct checkpoint_header hdr;
+	string tmp_path = path + ".tmp";
+	ofstream out(tmp_path, ios::binary | ios::trunc);
+	int fd;
+
+	memset(&hdr, 0, sizeof hdr);
+	memcpy(hdr.magic, CHECKPOINT_MAGIC, sizeof hdr.magic);
+	hdr.version = CHECKPOINT_VERSION;
+	hdr.seed_len = seed.size();
+	hdr.n_emitted = n_emitted;
+	hdr.output_bytes = output_bytes;
+	out.write((const char*)&hdr, sizeof hdr);
+	out.write(seed.data(), seed.size());
+	cursor.save(out);
+	out.close();
+	if (out.fail()) {
+		cerr << "Failed to write checkpoint \"" << tmp_path << "\"\n";
+		return false;
+	}
+
+	if ((fd = open(tmp_path.c_str(), O_WRONLY)) >= 0) {
+		fsync(fd);
+		close(fd);
+	}
+	if (rename(tmp_path.c_str(), path.c_str()) < 0) {
+		cerr << "Failed to replace checkpoint \"" << path << "\"\n";
+		return false;
+	}
+	return true;
+}
+
+
+static bool load_checkpoint(const string& path, const string& seed,
+			    event_cursor& cursor, uint64_t& n_emitted,
+			    uint64_t& output_bytes)
+{
+	struct checkpoint_header hdr;
+	string saved_seed;
+	ifstream in(path, ios::binary);
+	if (!in.is_open()) {
+		cerr << "Failed to open file \"" << path << "\"\n";
+		return false;
+	}
+
+	if (!in.read((char*)&hdr, sizeof hdr) ||
+	    memcmp(hdr.magic, CHECKPOINT_MAGIC, sizeof hdr.magic) ||
+	    hdr.version != CHECKPOINT_VERSION) {
+		cerr << "Not a checkpoint file \"" << path << "\"\n";
+		return false;
+	}
+	saved_seed.resize(hdr.seed_len);
+	if (!in.read(&saved_seed[0], hdr.seed_len) || saved_seed != seed) {
+		cerr << "Checkpoint was made for another seed\n";
+		return false;
+	}
+	if (!cursor.restore(in))
+		return false;
+	n_emitted = hdr.n_emitted;
+	output_bytes = hdr.output_bytes;
+	return true;
+}
+
+
+/*
+ * Output written after the checkpoint is repeated on resume. If it went to a
+ * file, cut the file back to the checkpoint so nothing appears twice.
+ */
+static bool rewind_output(int fd, uint64_t output_bytes)
+{
+	struct stat st;
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode))
+		return true;
+	if ((uint64_t)st.st_size < output_bytes) {
+		cerr << "Output is shorter than at the checkpoint, append to "
+		     << "the output of the interrupted run\n";
+		return false;
+	}
+	if (ftruncate(fd, output_bytes) < 0 ||
+	    lseek(fd, 0, SEEK_END) < 0) {
+		cerr << "Failed to rewind output to the checkpoint\n";
+		return false;
+	}
+	return true;
+}
+
+
+/*
+ * Serial enumeration of a single seed. With a checkpoint path, the cursor is
+ * saved along with the number of candidates and bytes written every interval
+ * seconds and once more at the end, including when the time budget runs out.
+ * Output is flushed before every checkpoint, so it always holds exactly the
+ * candidates the checkpoint accounts for.
+ */
+static int run_serial(const string& seed, event_cursor& cursor,
+		      struct ev_data *cb_data, candidate_writer& writer,
+		      const char *path, bool resume, unsigned interval)
+{
+	typedef chrono::steady_clock clock;
+	vector<int> outcomes;
+	double logprob;
+	uint64_t n_emitted = 0, output_base = 0;
+	clock::time_point last_checkpoint = clock::now();
+	struct run_monitor *monitor = cb_data->monitor;
+
+	if (resume) {
+		if (!load_checkpoint(path, seed, cursor, n_emitted,
+				     output_base))
+			return -1;
+		if (!rewind_output(STDOUT_FILENO, output_base))
+			return -1;
+	}
+
+	while (cursor.next(outcomes, logprob)) {
+		if (!event_iteration_cb(outcomes, logprob, cb_data)) {
+			// Written before the budget ran out
+			if (!monitor || !monitor->out_of_time)
+				return 0;
+			n_emitted++;
+			break;
+		}
+		if (!path || ++n_emitted % CHECKPOINT_CHECK_PERIOD != 0 ||
+		    clock::now() - last_checkpoint < chrono::seconds(interval))
+			continue;
+		if (!writer.flush())
+			return 0;
+		if (!save_checkpoint(path, seed, cursor, n_emitted,
+				     output_base + writer.written()))
+			return -1;
+		last_checkpoint = clock::now();
+	}
+
+	if (!writer.flush() || !path)
+		return 0;
+	return save_checkpoint(path, seed, cursor, n_emitted,
+			       output_base + writer.written()) ? 0 : -1;
+}
+
+
+/* Log-probability of the likeliest outcome of a character event giving c */
+static double char_logprob(const outcome_span& event,
+			   const unsigned char *replacements, char c)
+{
+	for (const outcome& o : event)
+		if (replacements[o.identifier] == (unsigned char)c)
+			return o.logarithmic_probability;
+	return -INFINITY;
+}
+
+
+/* Log-probability of the outcome of a string event with the identifier */
+static double string_logprob(const outcome_span& event, int identifier)
+{
+	for (const outcome& o : event)
+		if (o.identifier == identifier)
+			return o.logarithmic_probability;
+	return -INFINITY;
+}
+
+
+/* Indices of the strings of table that start or end password */
+static vector<int> string_matches(const struct string_table *table,
+				  const string& password, bool at_end)
+{
+	vector<int> matches;
+	for (uint64_t i=0; i<table->n_strings; i++) {
+		uint64_t begin = table->offsets[i], len = table->offsets[i+1] -
+							 begin;
+		size_t offset = at_end ? password.size() - len : 0;
+		if (len <= password.size() &&
+		    !memcmp(password.data() + offset, table->pool + begin, len))
+			matches.push_back(i);
+	}
+	return matches;
+}
+
+
+/*
+ * Several prefix and suffix splits may produce the same password, the
+ * likeliest one is where the enumeration first prints it. False if no split
+ * does.
+ */
+static bool password_logprob(const event_list *ev_list,
+			     const struct ev_data *data,
+			     const string& password, double& logprob)
+{
+	const candidate_renderer& renderer = data->renderer;
+	int n_events = renderer.n_events, seed_len = n_events - 2;
+	const vector<outcome_span>& events = ev_list->events;
+	vector<int> prefixes, suffixes;
+
+	logprob = -INFINITY;
+	prefixes = string_matches(renderer.prefixes, password, false);
+	suffixes = string_matches(renderer.suffixes, password, true);
+	for (int prefix_idx : prefixes) {
+		const uint64_t *offsets = renderer.prefixes->offsets;
+		size_t seed_offset = offsets[prefix_idx + 1] -
+				     offsets[prefix_idx];
+		double head_logprob;
+		if (seed_offset + seed_len > password.size())
+			continue;
+		// Summed in event order like the best log-probability, so the
+		// likeliest list never comes out likelier than that
+		head_logprob = string_logprob(events[0], prefix_idx);
+		head_logprob += char_logprob(events[1],
+					     renderer.leadingchar_replacements,
+					     password[seed_offset]);
+		for (int i=1; i<seed_len; i++) {
+			const unsigned char *replacements =
+				renderer.normal_replacements[i-1];
+			head_logprob += char_logprob(events[i+1], replacements,
+						     password[seed_offset + i]);
+		}
+
+		for (int suffix_idx : suffixes) {
+			const uint64_t *offsets = renderer.suffixes->offsets;
+			size_t suffix_len = offsets[suffix_idx + 1] -
+					    offsets[suffix_idx];
+			double total;
+			if (seed_offset + seed_len + suffix_len !=
+			    password.size())
+				continue;
+			total = head_logprob +
+				string_logprob(events[n_events-1], suffix_idx);
+			if (total > logprob)
+				logprob = total;
+		}
+	}
+	return logprob > -INFINITY;
+}
+
+
+/* Parses <exact|approximate>[:<MiB>] */
+static bool parse_dedupe(const char *arg, enum dedupe_mode& mode,
+			 size_t& memory)
+{
+	const char *colon = strchr(arg, ':');
+	string name(arg, colon ? colon - arg : strlen(arg));
+	char *end;
+
+	if (name == "exact")
+		mode = DEDUPE_EXACT;
+	else if (name == "approximate")
+		mode = DEDUPE_APPROXIMATE;
+	else
+		return false;
+	memory = DEDUPE_DEFAULT_MEMORY;
+	if (!colon)
+		return true;
+	if (!isdigit((unsigned char)colon[1]))
+		return false;
+	memory = (size_t)strtoull(colon + 1, &end, 10) << 20;
+	return *end == '\0' && memory > 0;
+}
+
+
+static void print_usage(char *name)
+{
+	cerr << "Usage: " << name << " [options] <seed word> [<custom path "
+	     << "to frequency data file>]\n"
+	     << "       " << name << " [options] --batch <seed file> [<custom "
+	     << "path to frequency data\n"
+	     << "       file>]\n"
+	     << "       " << name << " [options] --merge <shard output>...\n"
+	     << "Options:\n"
+	     << "  -b, --batch <file>       Read seeds from a file ('-' for "
+	     << "stdin), one per line\n"
+	     << "                           and optionally followed by a tab "
+	     << "and a weight, and\n"
+	     << "                           print the candidates of all seeds "
+	     << "in one order\n"
+	     << "  -n, --limit <N>          Stop after N candidates\n"
+	     << "  -p, --min-logprob <X>    Skip candidates with a natural "
+	     << "log-probability below X\n"
+	     << "  -d, --delimiter <D>      Terminate candidates with a "
+	     << "newline (D=newline, default),\n"
+	     << "                           a NUL byte (D=nul) or precede "
+	     << "them with their\n"
+	     << "                           32-bit little-endian length "
+	     << "(D=length)\n"
+	     << "  -l, --print-logprob      Print the natural log-probability "
+	     << "and a tab\n"
+	     << "                           before each candidate\n"
+	     << "  -t, --threads <N>        Enumerate on N threads (default "
+	     << "1)\n"
+	     << "  -c, --checkpoint <file>  Save the enumeration state to a "
+	     << "file periodically\n"
+	     << "  -i, --checkpoint-interval <S>\n"
+	     << "                           Seconds between checkpoints "
+	     << "(default "
+	     << CHECKPOINT_DEFAULT_INTERVAL << ")\n"
+	     << "  -r, --resume             Continue from the checkpoint "
+	     << "file, appending to the\n"
+	     << "                           output of the interrupted run\n"
+	     << "  -s, --shard <I/N>        Enumerate only shard I of N "
+	     << "(1 <= I <= N)\n"
+	     << "  -m, --merge              Merge shard outputs printed with "
+	     << "-l into one order\n"
+	     << "  -w, --band-width <W>     Enumerate in constant memory, in "
+	     << "bands of W nats of\n"
+	     << "                           log-probability and in no "
+	     << "particular order within a\n"
+	     << "                           band\n"
+	     << "  -k, --count <X>          Print bounds on the number of "
+	     << "candidates with a\n"
+	     << "                           natural log-probability of X or "
+	     << "more and exit\n"
+	     << "  -g, --rank <password>    Print bounds on the position at "
+	     << "which password would\n"
+	     << "                           be printed and its "
+	     << "log-probability, and exit\n"
+	     << "  -u, --dedupe <M>[:MiB]   Skip repeated candidates, "
+	     << "exactly (M=exact) or with a\n"
+	     << "                           Bloom filter (M=approximate), "
+	     << "in at most MiB\n"
+	     << "                           megabytes (default "
+	     << (DEDUPE_DEFAULT_MEMORY >> 20) << ")\n"
+	     << "  -S, --stats <S>          Print statistics to stderr every "
+	     << "S seconds (0 for\n"
+	     << "                           only on SIGUSR1) and at the end "
+	     << "of the run\n"
+	     << "  -T, --time-budget <S>    Stop cleanly after S seconds\n";
+}
+
+
+/*
+ * Reports on a run that stopped with the given status, which is passed
+ * through.
+ */
+static int finish_run(const struct run_monitor *monitor, int ret)
+{
+	struct itimerval stop = {};
+	if (!monitor)
+		return ret;
+	setitimer(ITIMER_REAL, &stop, NULL);
+	if (monitor->out_of_time)
+		cerr << "Time budget exhausted\n";
+	if (monitor->report)
+		print_stats(monitor);
+	return ret;
 }
 
 
 int main(int argc, char *argv[])
 {
-	int n_events = 0;
+	int opt, n_args, ret = 0;
+	struct run_monitor monitor = {};
+	bool monitored, report_stats = false;
+	unsigned long stats_interval = 0;
+	double time_budget = 0.0;
 	event_list *ev_list;
 	frequency_data_loader loader;
-	char *freq_file = FREQDATA_DEFAULT_PATH, *seed;
+	char *freq_file = FREQDATA_DEFAULT_PATH, *seed = NULL, *end;
+	char *batch_file = NULL, *checkpoint_file = NULL;
+	bool resume = false, merge = false;
+	unsigned long shard_idx = 0, n_shards = 0;
+	double band_width = 0.0;
+	double count_logprob = NAN;
+	char *rank_password = NULL;
+	unique_ptr<candidate_filter> filter;
+	enum dedupe_mode dedupe = DEDUPE_EXACT;
+	size_t dedupe_memory = 0;
+	unsigned long checkpoint_interval = CHECKPOINT_DEFAULT_INTERVAL;
 	struct ev_data cb_data;
-	vector<int> event_indices;
-	vector<frequency> outcome_freqs;
+	// Event list a shard was cut from, it must outlive the shard
+	unique_ptr<event_list> unsharded_list;
+	unsigned long long limit = 0, output_limit = 0;
+	double min_logprob = -INFINITY;
+	enum output_delimiter delimiter = DELIMIT_NEWLINE;
+	bool print_logprob = false;
+	int n_threads = 1;
+	static const struct option long_options[] = {
+		{"limit", required_argument, NULL, 'n'},
+		{"min-logprob", required_argument, NULL, 'p'},
+		{"delimiter", required_argument, NULL, 'd'},
+		{"print-logprob", no_argument, NULL, 'l'},
+		{"threads", required_argument, NULL, 't'},
+		{"batch", required_argument, NULL, 'b'},
+		{"checkpoint", required_argument, NULL, 'c'},
+		{"checkpoint-interval", required_argument, NULL, 'i'},
+		{"resume", no_argument, NULL, 'r'},
+		{"shard", required_argument, NULL, 's'},
+		{"merge", no_argument, NULL, 'm'},
+		{"band-width", required_argument, NULL, 'w'},
+		{"count", required_argument, NULL, 'k'},
+		{"rank", required_argument, NULL, 'g'},
+		{"dedupe", required_argument, NULL, 'u'},
+		{"stats", required_argument, NULL, 'S'},
+		{"time-budget", required_argument, NULL, 'T'},
+		{NULL, 0, NULL, 0},
+	};
 
-	if (argc != 2 && argc != 3) {
-		cerr << "Usage: " << argv[0] << " <seed word> [<custom path "
-		     << "to frequency data file>]\n";
+	// Time budgets include loading the frequency data
+	monitor.start = chrono::steady_clock::now();
+	while ((opt = getopt_long(argc, argv, "n:p:d:lt:b:c:i:rs:mw:k:g:u:S:T:",
+				  long_options, NULL)) != -1) {
+		switch (opt) {
+		case 'n':
+			limit = strtoull(optarg, &end, 10);
+			if (*optarg == '\0' || *optarg == '-' || *end != '\0') {
+				cerr << "Invalid limit \"" << optarg << "\"\n";
+				return -1;
+			}
+			break;
+		case 'p':
+			min_logprob = strtod(optarg, &end);
+			if (*optarg == '\0' || *end != '\0') {
+				cerr << "Invalid log-probability \"" << optarg
+				     << "\"\n";
+				return -1;
+			}
+			break;
+		case 'd':
+			if (!strcmp(optarg, "newline"))
+				delimiter = DELIMIT_NEWLINE;
+			else if (!strcmp(optarg, "nul"))
+				delimiter = DELIMIT_NUL;
+			else if (!strcmp(optarg, "length"))
+				delimiter = DELIMIT_LENGTH;
+			else {
+				cerr << "Invalid delimiter \"" << optarg
+				     << "\"\n";
+				return -1;
+			}
+			break;
+		case 'l':
+			print_logprob = true;
+			break;
+		case 't':
+			n_threads = strtol(optarg, &end, 10);
+			if (*optarg == '\0' || *end != '\0' || n_threads < 1) {
+				cerr << "Invalid thread count \"" << optarg
+				     << "\"\n";
+				return -1;
+			}
+			break;
+		case 'b':
+			batch_file = optarg;
+			break;
+		case 'c':
+			checkpoint_file = optarg;
+			break;
+		case 'i':
+			checkpoint_interval = strtoul(optarg, &end, 10);
+			if (*optarg == '\0' || *optarg == '-' || *end != '\0') {
+				cerr << "Invalid checkpoint interval \"" << optarg
+				     << "\"\n";
+				return -1;
+			}
+			break;
+		case 'r':
+			resume = true;
+			break;
+		case 's':
+			n_shards = 0;
+			shard_idx = strtoul(optarg, &end, 10);
+			if (*optarg != '-' && end != optarg && *end == '/' &&
+			    end[1] != '-')
+				n_shards = strtoul(end + 1, &end, 10);
+			if (*end != '\0' || shard_idx < 1 ||
+			    shard_idx > n_shards) {
+				cerr << "Invalid shard \"" << optarg << "\"\n";
+				return -1;
+			}
+			break;
+		case 'm':
+			merge = true;
+			break;
+		case 'k':
+			count_logprob = strtod(optarg, &end);
+			if (*optarg == '\0' || *end != '\0' ||
+			    isnan(count_logprob)) {
+				cerr << "Invalid log-probability \"" << optarg
+				     << "\"\n";
+				return -1;
+			}
+			break;
+		case 'g':
+			rank_password = optarg;
+			break;
+		case 'u':
+			if (!parse_dedupe(optarg, dedupe, dedupe_memory)) {
+				cerr << "Invalid deduplication \"" << optarg
+				     << "\"\n";
+				return -1;
+			}
+			break;
+		case 'w':
+			band_width = strtod(optarg, &end);
+			if (*optarg == '\0' || *end != '\0' ||
+			    !(band_width > 0) || isinf(band_width)) {
+				cerr << "Invalid band width \"" << optarg
+				     << "\"\n";
+				return -1;
+			}
+			break;
+		case 'S':
+			report_stats = true;
+			stats_interval = strtoul(optarg, &end, 10);
+			if (*optarg == '\0' || *optarg == '-' || *end != '\0') {
+				cerr << "Invalid statistics interval \""
+				     << optarg << "\"\n";
+				return -1;
+			}
+			break;
+		case 'T':
+			time_budget = strtod(optarg, &end);
+			if (*optarg == '\0' || *end != '\0' ||
+			    !(time_budget > 0) || isinf(time_budget)) {
+				cerr << "Invalid time budget \"" << optarg
+				     << "\"\n";
+				return -1;
+			}
+			break;
+		default:
+			print_usage(argv[0]);
+			return -1;
+		}
+	}
+	monitored = report_stats || time_budget;
+	if (monitored && merge) {
+		cerr << "Merging does not support statistics or a time "
+		     << "budget\n";
+		return -1;
+	}
+	if (dedupe_memory && checkpoint_file) {
+		cerr << "Deduplication does not support checkpoints\n";
+		return -1;
+	}
+	if (dedupe_memory) {
+		filter.reset(new candidate_filter(dedupe, dedupe_memory));
+		// Dropped repeats do not count, so the writer enforces the
+		// limit instead of the enumeration
+		output_limit = limit;
+		limit = 0;
+	}
+	if (merge) {
+		vector<string> paths(argv + optind, argv + argc);
+		if (paths.empty()) {
+			print_usage(argv[0]);
+			return -1;
+		}
+		candidate_writer writer(STDOUT_FILENO, delimiter,
+					print_logprob);
+		writer.set_filter(filter.get());
+		writer.set_limit(output_limit);
+		return merge_shards(paths, delimiter, writer, limit);
+	}
+	// The seed is taken from the batch file instead of the command line
+	n_args = argc - optind + (batch_file ? 1 : 0);
+	if (n_args != 1 && n_args != 2) {
+		print_usage(argv[0]);
+		return -1;
+	}
+	if (batch_file && n_threads > 1) {
+		cerr << "Batch mode does not support multiple threads\n";
+		return -1;
+	}
+	if (resume && !checkpoint_file) {
+		cerr << "Resuming requires a checkpoint file\n";
+		return -1;
+	}
+	if (n_shards && batch_file) {
+		cerr << "Batch mode does not support sharding\n";
+		return -1;
+	}
+	if ((!isnan(count_logprob) || rank_password) && batch_file) {
+		cerr << "Batch mode does not support keyspace queries\n";
+		return -1;
+	}
+	if (band_width && (batch_file || n_threads > 1 || checkpoint_file)) {
+		cerr << "Banded enumeration only supports a single seed on "
+		     << "one thread without checkpoints\n";
+		return -1;
+	}
+	if (checkpoint_file && (batch_file || n_threads > 1)) {
+		cerr << "Checkpoints are only supported for a single seed on "
+		     << "one thread\n";
 		return -1;
 	}
-	seed = argv[1];
-	if (argc == 3)
-		freq_file = argv[2];
+	if (!batch_file)
+		seed = argv[optind++];
+	if (optind < argc)
+		freq_file = argv[optind];
 
 	if (!loader.load_frequency_file(freq_file)) {
 		cerr << "No frequency data loaded from " << freq_file << "\n";
 		cerr << "Frequency data missing or corrupt...\n";
 		return -1;
 	}
+	candidate_writer writer(STDOUT_FILENO, delimiter, print_logprob);
+	writer.set_filter(filter.get());
+	writer.set_limit(output_limit);
+	if (monitored) {
+		typedef chrono::steady_clock clock;
+		struct sigaction action;
+		monitor.report = report_stats;
+		monitor.interval = stats_interval;
+		monitor.next_report = monitor.start +
+				      chrono::seconds(stats_interval);
+		monitor.budgeted = time_budget > 0;
+		monitor.deadline = monitor.start +
+				   chrono::duration_cast<clock::duration>(
+					   chrono::duration<double>(time_budget));
+		monitor.logprob = NAN;
+		monitor.writer = &writer;
+		struct itimerval tick = {
+			{0, MONITOR_TICK_USEC},
+			{0, MONITOR_TICK_USEC},
+		};
+		memset(&action, 0, sizeof action);
+		action.sa_handler = request_stats;
+		action.sa_flags = SA_RESTART;
+		if (report_stats)
+			sigaction(SIGUSR1, &action, NULL);
+		action.sa_handler = request_check;
+		sigaction(SIGALRM, &action, NULL);
+		setitimer(ITIMER_REAL, &tick, NULL);
+	}
 
-	// Initialize event list
-	n_events += strlen(seed);
-	n_events += 1 + 1; // Prefix and suffix events
-	cb_data.seed = seed;
-	cb_data.n_events = n_events;
-	ev_list = new event_list(n_events);
-
-	// Prefix events
-	loader.get_prefix_frequencies(cb_data.prefixes, outcome_freqs);
-	event_indices.clear();
-	for (int i=0; i<cb_data.prefixes.size(); i++)
-		event_indices.push_back(i);
-	ev_list->set_event_sample_space(0, event_indices, outcome_freqs);
-
-	// Leading character events
-	loader.get_leadingchar_frequencies(seed[0],
-					   cb_data.leadingchar_replacements,
-					   outcome_freqs);
-	event_indices.clear();
-	for (int i=0; i<cb_data.leadingchar_replacements.size(); i++)
-		event_indices.push_back(i);
-	ev_list->set_event_sample_space(1, event_indices, outcome_freqs);
-
-	// Normal character events
-	for (int i=1; seed[i]; i++) {
-		vector<char> replacements;
-		loader.get_normalchar_frequencies(seed[i], replacements,
-						  outcome_freqs);
-		event_indices.clear();
-		for (int j=0; j<replacements.size(); j++)
-			event_indices.push_back(j);
-		ev_list->set_event_sample_space(i+1, event_indices,
-						outcome_freqs);
-		cb_data.normal_replacements.push_back(replacements);
-	}
-
-	// Suffix events
-	loader.get_suffix_frequencies(cb_data.suffixes, outcome_freqs);
-	event_indices.clear();
-	for (int i=0; i<cb_data.suffixes.size(); i++)
-		event_indices.push_back(i);
-	ev_list->set_event_sample_space(n_events-1, event_indices,
-					outcome_freqs);
+	if (batch_file) {
+		if (!strcmp(batch_file, "-"))
+			return finish_run(monitored ? &monitor : NULL,
+					  run_batch(loader, cin, writer, limit,
+						    min_logprob,
+						    monitored ? &monitor
+							      : NULL));
+		ifstream seed_stream(batch_file);
+		if (!seed_stream.is_open()) {
+			cerr << "Failed to open file \"" << batch_file
+			     << "\"\n";
+			return -1;
+		}
+		return finish_run(monitored ? &monitor : NULL,
+				  run_batch(loader, seed_stream, writer, limit,
+					    min_logprob,
+					    monitored ? &monitor : NULL));
+	}
 
 	// Main iteration
-	ev_list->iterate_sorted(event_iteration_cb, &cb_data);
+	if (!(ev_list = build_event_list(loader, seed, &cb_data)))
+		return -1;
+	cb_data.writer = &writer;
+	cb_data.monitor = monitored ? &monitor : NULL;
+	ev_list->set_limits(limit, min_logprob);
+	if (!isnan(count_logprob) || rank_password) {
+		// Queries cover the whole keyspace of the seed, limits aside
+		double lower, upper, logprob = count_logprob;
+		if (rank_password &&
+		    !password_logprob(ev_list, &cb_data, rank_password,
+				      logprob)) {
+			cerr << "Password is never generated from this seed\n";
+			delete ev_list;
+			return 1;
+		}
+		ev_list->count_likelier(logprob, KEYSPACE_BINS, lower, upper);
+		if (rank_password)
+			// Ranks count from 1, ties may come in any order
+			printf("%.0f\t%.0f\t%.17g\n", lower + 1, upper,
+			       logprob);
+		else
+			printf("%.0f\t%.0f\n", lower, upper);
+		delete ev_list;
+		return 0;
+	}
+	if (n_shards) {
+		// Striping the largest event gives every shard a disjoint share
+		// of the lattice with about the same mix of likely candidates
+		event_list *shard_list = ev_list->partition(
+			ev_list->partition_event(), n_shards, shard_idx - 1);
+		unsharded_list.reset(ev_list);
+		ev_list = shard_list;
+	}
+	if (band_width)
+		ev_list->iterate_banded(event_iteration_cb, &cb_data,
+					band_width);
+	else if (n_threads > 1)
+		ev_list->iterate_sorted_parallel(event_iteration_cb, &cb_data,
+						 n_threads);
+	else {
+		event_cursor cursor(*ev_list);
+		if (monitored)
+			watch_cursor(&monitor, &cursor);
+		ret = run_serial(seed, cursor, &cb_data, writer,
+				 checkpoint_file, resume, checkpoint_interval);
+		if (monitored)
+			retire_cursors(&monitor);
+	}
+	writer.flush();
 
 	delete ev_list;
-	return 0;
+	return finish_run(monitored ? &monitor : NULL, ret);
 }
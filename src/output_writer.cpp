@@ -0,0 +1,187 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <charconv>
+#include <iostream>
+#include <vector>
+#include "output_writer.hpp"
+#include "dedupe.hpp"
+
+
+using namespace std;
+
+
+candidate_writer::candidate_writer(int fd, enum output_delimiter delimiter,
+				   bool print_logprob, size_t capacity)
+{
+	this->fd = fd;
+	this->delimiter = delimiter;
+	this->print_logprob = print_logprob;
+	this->capacity = capacity;
+	this->used = 0;
+	this->bytes_written = 0;
+	this->failed = false;
+	this->filter = NULL;
+	this->max_candidates = 0;
+	this->n_candidates = 0;
+	if (!(this->buffer = (char*)malloc(capacity))) {
+		cerr << __func__ << ": Out of memory...\n";
+		this->capacity = 0;
+		this->failed = true;
+	}
+}
+
+
+candidate_writer::~candidate_writer(void)
+{
+	flush();
+	free(buffer);
+}
+
+
+void
+candidate_writer::set_filter(candidate_filter *filter)
+{
+	this->filter = filter;
+}
+
+
+void
+candidate_writer::set_limit(unsigned long long max_candidates)
+{
+	this->max_candidates = max_candidates;
+}
+
+
+bool
+candidate_writer::write_all(struct iovec *iov, int n_iov)
+{
+	while (n_iov > 0) {
+		ssize_t n_written = writev(fd, iov, n_iov);
+		if (n_written < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EPIPE)
+				cerr << __func__ << ": " << strerror(errno)
+				     << "...\n";
+			failed = true;
+			return false;
+		}
+		bytes_written += n_written;
+		// Skip what went out, writev may stop anywhere
+		while (n_iov > 0 && (size_t)n_written >= iov->iov_len) {
+			n_written -= iov->iov_len;
+			iov++;
+			n_iov--;
+		}
+		if (n_iov > 0) {
+			iov->iov_base = (char*)iov->iov_base + n_written;
+			iov->iov_len -= n_written;
+		}
+	}
+
+	return true;
+}
+
+
+bool
+candidate_writer::flush(void)
+{
+	struct iovec iov;
+	if (failed)
+		return false;
+	if (used == 0)
+		return true;
+	iov.iov_base = buffer;
+	iov.iov_len = used;
+	used = 0;
+	return write_all(&iov, 1);
+}
+
+
+size_t
+candidate_writer::format_header(char *dest, size_t body_len, double logprob)
+{
+	char *column = dest;
+	size_t column_len = 0;
+	uint32_t record_len;
+
+	if (delimiter == DELIMIT_LENGTH)
+		column += sizeof record_len;
+	if (print_logprob) {
+		char *column_end = column + OUTPUT_LOGPROB_MAXLEN - 1;
+		char *end = to_chars(column, column_end, logprob).ptr;
+		*end++ = '\t';
+		column_len = end - column;
+	}
+	if (delimiter != DELIMIT_LENGTH)
+		return column_len;
+
+	record_len = column_len + body_len;
+	for (int i=0; i<sizeof record_len; i++)
+		dest[i] = (char)(record_len >> (8 * i));
+	return sizeof record_len + column_len;
+}
+
+
+bool
+candidate_writer::write_oversized(const char *const *parts, const size_t *lens,
+				  int n_parts, const char *header,
+				  size_t header_len, const char *trailer,
+				  size_t trailer_len)
+{
+	vector<struct iovec> iov;
+	iov.push_back((struct iovec){(void*)header, header_len});
+	for (int i=0; i<n_parts; i++)
+		iov.push_back((struct iovec){(void*)parts[i], lens[i]});
+	iov.push_back((struct iovec){(void*)trailer, trailer_len});
+	return write_all(iov.data(), iov.size());
+}
+
+
+bool
+candidate_writer::write_candidate(const char *const *parts, const size_t *lens,
+				  int n_parts, double logprob)
+{
+	char header[sizeof(uint32_t) + OUTPUT_LOGPROB_MAXLEN], *dest;
+	char trailer = delimiter == DELIMIT_NUL ? '\0' : '\n';
+	size_t header_len, body_len = 0, record_len;
+	size_t trailer_len = delimiter == DELIMIT_LENGTH ? 0 : 1;
+
+	if (failed)
+		return false;
+	if (filter && !filter->insert(parts, lens, n_parts))
+		return true;
+	for (int i=0; i<n_parts; i++)
+		body_len += lens[i];
+	header_len = format_header(header, body_len, logprob);
+	record_len = header_len + body_len + trailer_len;
+
+	if (record_len > capacity - used) {
+		if (!flush())
+			return false;
+		if (record_len > capacity) {
+			if (!write_oversized(parts, lens, n_parts, header,
+					     header_len, &trailer, trailer_len))
+				return false;
+			n_candidates++;
+			return !max_candidates ||
+			       n_candidates < max_candidates;
+		}
+	}
+
+	dest = buffer + used;
+	memcpy(dest, header, header_len);
+	dest += header_len;
+	for (int i=0; i<n_parts; i++) {
+		memcpy(dest, parts[i], lens[i]);
+		dest += lens[i];
+	}
+	if (trailer_len)
+		*dest = trailer;
+	used += record_len;
+	n_candidates++;
+	return !max_candidates || n_candidates < max_candidates;
+}
@@ -0,0 +1,87 @@
+#ifndef OUTPUT_WRITER_H
+#define OUTPUT_WRITER_H
+
+#include <stddef.h>
+#include <string.h>
+
+#define OUTPUT_BUFFER_SIZE (1 << 20)
+// Longest text a double is rendered to by to_chars, plus the column separator
+#define OUTPUT_LOGPROB_MAXLEN 32
+
+
+using namespace std;
+
+
+class candidate_filter;
+
+
+enum output_delimiter {
+	// Candidates terminated by '\n'
+	DELIMIT_NEWLINE,
+	// Candidates terminated by '\0'
+	DELIMIT_NUL,
+	// Candidates preceded by their length as a 32-bit little-endian integer
+	DELIMIT_LENGTH,
+};
+
+
+/*
+ * Buffered candidate output. Records are assembled from their parts directly
+ * in a large reusable buffer which is handed to write(2) only when full, so
+ * the cost per candidate is a few memcpys. Records that do not fit the buffer
+ * at all are written with a single writev(2) instead.
+ *
+ * A record is the optional log-probability column (followed by a tab) and the
+ * concatenated parts of the candidate, with the selected delimiter.
+ */
+class candidate_writer {
+	private:
+	int fd;
+	enum output_delimiter delimiter;
+	bool print_logprob;
+	char *buffer;
+	size_t capacity, used;
+	unsigned long long bytes_written;
+	bool failed;
+	candidate_filter *filter;
+	unsigned long long max_candidates, n_candidates;
+	bool write_all(struct iovec *iov, int n_iov);
+	bool write_oversized(const char *const *parts, const size_t *lens,
+			     int n_parts, const char *header,
+			     size_t header_len, const char *trailer,
+			     size_t trailer_len);
+	size_t format_header(char *dest, size_t record_len, double logprob);
+	public:
+	candidate_writer(int fd, enum output_delimiter delimiter,
+			 bool print_logprob,
+			 size_t capacity = OUTPUT_BUFFER_SIZE);
+	candidate_writer(const candidate_writer&) = delete;
+	candidate_writer& operator =(const candidate_writer&) = delete;
+	// Candidates already seen by the filter are skipped
+	void set_filter(candidate_filter *filter);
+	// Stop after max_candidates written candidates (0 for no limit)
+	void set_limit(unsigned long long max_candidates);
+	// False once the limit is reached or a write failed
+	bool write_candidate(const char *const *parts, const size_t *lens,
+			     int n_parts, double logprob);
+	bool flush(void);
+	/* Bytes handed to the kernel so far */
+	inline unsigned long long written(void) const
+	{
+		return bytes_written;
+	}
+	/* Candidates written so far, not counting those the filter dropped */
+	inline unsigned long long candidates_written(void) const
+	{
+		return n_candidates;
+	}
+	/* False once a write failed, e.g. because the reader went away */
+	inline bool ok(void) const
+	{
+		return !failed;
+	}
+	~candidate_writer(void);
+};
+
+
+#endif /* OUTPUT_WRITER_H */
@@ -0,0 +1,192 @@
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+#include "event_iterator.hpp"
+
+// Candidates per batch handed from an enumerating thread to the merger
+#define PARALLEL_BATCH_SIZE 4096
+// Batches an enumerating thread may run ahead of the merger
+#define PARALLEL_MAX_PENDING 8
+
+
+using namespace std;
+
+
+struct candidate_batch {
+	// n_events identifiers per candidate
+	vector<int> identifiers;
+	vector<double> logprobs;
+};
+
+
+/*
+ * Sorted candidates of one part of the lattice, passed from the thread
+ * enumerating it to the merging thread in bounded batches. Spent batches are
+ * handed back so their storage is reused.
+ */
+struct candidate_stream {
+	mutex lock;
+	condition_variable cond;
+	deque<candidate_batch> ready, spare;
+	candidate_batch filling;
+	bool finished, cancelled;
+};
+
+
+static bool stream_push_batch(struct candidate_stream *stream)
+{
+	unique_lock<mutex> guard(stream->lock);
+	stream->cond.wait(guard, [stream] {
+		return stream->cancelled ||
+		       stream->ready.size() < PARALLEL_MAX_PENDING;
+	});
+	if (stream->cancelled)
+		return false;
+	stream->ready.push_back(move(stream->filling));
+	if (stream->spare.empty()) {
+		stream->filling = candidate_batch();
+	} else {
+		stream->filling = move(stream->spare.front());
+		stream->spare.pop_front();
+	}
+	stream->filling.identifiers.clear();
+	stream->filling.logprobs.clear();
+	stream->cond.notify_all();
+	return true;
+}
+
+
+static bool stream_produce_cb(const vector<int>& outcomes, double logprob,
+			      void *cb_data)
+{
+	struct candidate_stream *stream = (struct candidate_stream*)cb_data;
+	candidate_batch& batch = stream->filling;
+	batch.identifiers.insert(batch.identifiers.end(), outcomes.begin(),
+				 outcomes.end());
+	batch.logprobs.push_back(logprob);
+	if (batch.logprobs.size() < PARALLEL_BATCH_SIZE)
+		return true;
+	return stream_push_batch(stream);
+}
+
+
+static void stream_produce(event_list *list, struct candidate_stream *stream)
+{
+	list->iterate_sorted(stream_produce_cb, stream);
+	if (!stream->filling.logprobs.empty())
+		stream_push_batch(stream);
+	lock_guard<mutex> guard(stream->lock);
+	stream->finished = true;
+	stream->cond.notify_all();
+}
+
+
+/* Blocks until the next batch is available, false at the end of the stream */
+static bool stream_pop_batch(struct candidate_stream *stream,
+			     candidate_batch& batch)
+{
+	unique_lock<mutex> guard(stream->lock);
+	stream->spare.push_back(move(batch));
+	stream->cond.wait(guard, [stream] {
+		return stream->finished || !stream->ready.empty();
+	});
+	if (stream->ready.empty())
+		return false;
+	batch = move(stream->ready.front());
+	stream->ready.pop_front();
+	stream->cond.notify_all();
+	return true;
+}
+
+
+static void stream_cancel(struct candidate_stream *stream)
+{
+	lock_guard<mutex> guard(stream->lock);
+	stream->cancelled = true;
+	stream->cond.notify_all();
+}
+
+
+struct stream_head {
+	double logprob;
+	int stream_idx;
+	inline bool operator <(const stream_head& rhs) const
+	{
+		// Likeliest head on top, lower stream index first on ties
+		if (logprob == rhs.logprob)
+			return stream_idx > rhs.stream_idx;
+		return logprob < rhs.logprob;
+	}
+};
+
+
+void event_list::iterate_sorted_parallel(iterator_cb_t iterator_cb,
+					 void *cb_data, int n_threads)
+{
+	int split_event = partition_event(), n_parts;
+	vector<event_list*> parts;
+	vector<thread> threads;
+	vector<candidate_batch> batches;
+	vector<size_t> positions;
+	priority_queue<stream_head> heads;
+	vector<int> outcome_identifiers(n_events);
+	unsigned long long n_emitted = 0;
+
+	// A list without events has a single, empty candidate and nothing to
+	// split, so it goes to iterate_sorted like a single part does
+	n_parts = n_threads;
+	if (n_events > 0 && n_parts > events[split_event].size())
+		n_parts = events[split_event].size();
+	if (n_parts <= 1) {
+		iterate_sorted(iterator_cb, cb_data);
+		return;
+	}
+
+	vector<candidate_stream> streams(n_parts);
+	batches.resize(n_parts);
+	positions.resize(n_parts, 0);
+	for (int i=0; i<n_parts; i++) {
+		streams[i].finished = false;
+		streams[i].cancelled = false;
+		parts.push_back(partition(split_event, n_parts, i));
+	}
+	for (int i=0; i<n_parts; i++)
+		threads.push_back(thread(stream_produce, parts[i],
+					 &streams[i]));
+
+	for (int i=0; i<n_parts; i++)
+		if (stream_pop_batch(&streams[i], batches[i]))
+			heads.push((stream_head){batches[i].logprobs[0], i});
+	while (!heads.empty()) {
+		int i = heads.top().stream_idx;
+		size_t pos = positions[i];
+		candidate_batch& batch = batches[i];
+		const int *identifiers = &batch.identifiers[pos * n_events];
+		heads.pop();
+
+		for (int j=0; j<n_events; j++)
+			outcome_identifiers[j] = identifiers[j];
+		if (!iterator_cb(outcome_identifiers, batch.logprobs[pos],
+				 cb_data))
+			break;
+		if (max_candidates && ++n_emitted == max_candidates)
+			break;
+
+		if (++pos == batch.logprobs.size()) {
+			pos = 0;
+			if (!stream_pop_batch(&streams[i], batch))
+				continue;
+		}
+		positions[i] = pos;
+		heads.push((stream_head){batch.logprobs[pos], i});
+	}
+
+	for (int i=0; i<n_parts; i++) {
+		stream_cancel(&streams[i]);
+		threads[i].join();
+		delete parts[i];
+	}
+}
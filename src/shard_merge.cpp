@@ -0,0 +1,124 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <queue>
+#include "shard_merge.hpp"
+
+
+using namespace std;
+
+
+struct shard_reader {
+	ifstream in;
+	string path;
+	// Current record, the candidate starts at candidate_offset
+	string record;
+	size_t candidate_offset;
+	double logprob;
+	unsigned long long record_no;
+};
+
+
+/* Reads the next record of a shard, false at the end or on errors */
+static bool read_record(struct shard_reader *shard,
+			enum output_delimiter delimiter, bool& failed)
+{
+	size_t tab;
+	char *end;
+
+	failed = false;
+	if (delimiter == DELIMIT_LENGTH) {
+		unsigned char len_bytes[sizeof(uint32_t)];
+		uint32_t len = 0;
+		if (!shard->in.read((char*)len_bytes, sizeof len_bytes))
+			return false;
+		for (int i=0; i<sizeof len_bytes; i++)
+			len |= (uint32_t)len_bytes[i] << (8 * i);
+		shard->record.resize(len);
+		if (!shard->in.read(&shard->record[0], len)) {
+			cerr << shard->path << ": Truncated record...\n";
+			failed = true;
+			return false;
+		}
+	} else {
+		char trailer = delimiter == DELIMIT_NUL ? '\0' : '\n';
+		if (!getline(shard->in, shard->record, trailer))
+			return false;
+	}
+	shard->record_no++;
+
+	tab = shard->record.find('\t');
+	shard->logprob = strtod(shard->record.c_str(), &end);
+	if (tab == string::npos || end != shard->record.c_str() + tab) {
+		cerr << shard->path << ": Record " << shard->record_no
+		     << " has no log-probability, shards must be printed "
+		     << "with -l...\n";
+		failed = true;
+		return false;
+	}
+	shard->candidate_offset = tab + 1;
+	return true;
+}
+
+
+struct shard_head {
+	double logprob;
+	size_t shard_idx;
+	inline bool operator <(const shard_head& rhs) const
+	{
+		// Likeliest head on top, earlier shard first on ties
+		if (logprob == rhs.logprob)
+			return shard_idx > rhs.shard_idx;
+		return logprob < rhs.logprob;
+	}
+};
+
+
+int merge_shards(const vector<string>& paths, enum output_delimiter delimiter,
+		 candidate_writer& writer, unsigned long long limit)
+{
+	vector<unique_ptr<struct shard_reader>> shards;
+	priority_queue<shard_head> heads;
+	unsigned long long n_emitted = 0;
+	bool failed;
+
+	for (size_t i=0; i<paths.size(); i++) {
+		struct shard_reader *shard = new struct shard_reader;
+		shards.push_back(unique_ptr<struct shard_reader>(shard));
+		shard->path = paths[i];
+		shard->record_no = 0;
+		shard->in.open(paths[i], ios::binary);
+		if (!shard->in.is_open()) {
+			cerr << "Failed to open file \"" << paths[i] << "\"\n";
+			return -1;
+		}
+		if (read_record(shard, delimiter, failed))
+			heads.push((shard_head){shard->logprob, i});
+		else if (failed)
+			return -1;
+	}
+
+	while (!heads.empty()) {
+		size_t shard_idx = heads.top().shard_idx;
+		struct shard_reader *shard = shards[shard_idx].get();
+		const char *candidate = shard->record.data() +
+					shard->candidate_offset;
+		size_t len = shard->record.size() - shard->candidate_offset;
+		heads.pop();
+
+		if (!writer.write_candidate(&candidate, &len, 1,
+					    shard->logprob))
+			break;
+		if (limit && ++n_emitted == limit)
+			break;
+		if (read_record(shard, delimiter, failed))
+			heads.push((shard_head){shard->logprob, shard_idx});
+		else if (failed)
+			return -1;
+	}
+
+	writer.flush();
+	return 0;
+}
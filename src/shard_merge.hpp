@@ -0,0 +1,22 @@
+#ifndef SHARD_MERGE_H
+#define SHARD_MERGE_H
+
+#include <string>
+#include <vector>
+#include "output_writer.hpp"
+
+
+using namespace std;
+
+
+/*
+ * Merges the outputs of shards of one enumeration, each printed with its
+ * log-probability column and in the given delimiter, into one stream ordered
+ * by log-probability. Ties go to the earlier file. Stops after limit
+ * candidates (0 for no limit).
+ */
+int merge_shards(const vector<string>& paths, enum output_delimiter delimiter,
+		 candidate_writer& writer, unsigned long long limit);
+
+
+#endif /* SHARD_MERGE_H */
@@ -0,0 +1,183 @@
+#ifndef SLAB_POOL
+#define SLAB_POOL
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#define SLAB_POOL_DEFAULT_BLOCKS 4096
+
+
+using namespace std;
+
+
+/*
+ * Fixed-size block allocator. Blocks are carved out of large slabs and freed
+ * blocks are threaded onto an intrusive free list, so once the pool has grown
+ * to the working set size acquire/release never reach malloc/free. Slabs are
+ * only returned to the system when the pool is destroyed.
+ */
+class slab_pool {
+	private:
+	size_t block_size, blocks_per_slab;
+	vector<void*> slabs;
+	void *free_list;
+	char *slab_next, *slab_end;
+	void grow(void);
+	public:
+	slab_pool(size_t block_size,
+		  size_t blocks_per_slab = SLAB_POOL_DEFAULT_BLOCKS);
+	slab_pool(slab_pool&& pool);
+	slab_pool(const slab_pool&) = delete;
+	slab_pool& operator =(const slab_pool&) = delete;
+	inline void *acquire(void)
+	{
+		void *block;
+		if (free_list) {
+			block = free_list;
+			free_list = *(void**)block;
+			return block;
+		}
+		if (slab_next == slab_end)
+			grow();
+		block = slab_next;
+		slab_next += block_size;
+		return block;
+	}
+	inline void release(void *block)
+	{
+		*(void**)block = free_list;
+		free_list = block;
+	}
+	~slab_pool(void);
+};
+
+
+/*
+ * Slab pools of every block size asked for by the copies and rebinds of one
+ * pool_allocator. Not synchronized, the containers sharing it have to be used
+ * by one thread at a time.
+ */
+class slab_pool_set {
+	private:
+	vector<pair<size_t, unique_ptr<slab_pool>>> pools;
+	public:
+	slab_pool& get(size_t block_size);
+};
+
+
+/*
+ * STL allocator handing out single objects from slab pools of the rebound
+ * type. Meant for node based containers (set, map, list) whose nodes would
+ * otherwise cost a malloc/free pair each. A default constructed allocator
+ * starts a pool set of its own, which its copies and rebinds share and which
+ * is freed with the last of them, so whatever owns the allocator can move
+ * between threads.
+ */
+template <class U>
+struct pool_allocator {
+	typedef U value_type;
+	typedef true_type propagate_on_container_copy_assignment;
+	typedef true_type propagate_on_container_move_assignment;
+	typedef true_type propagate_on_container_swap;
+	shared_ptr<slab_pool_set> pools;
+	slab_pool *pool;
+	inline pool_allocator(void)
+		: pools(make_shared<slab_pool_set>()),
+		  pool(&pools->get(sizeof(U))) {}
+	// Copies rather than moves, so no allocator is ever left without pools
+	inline pool_allocator(const pool_allocator& alloc)
+		: pools(alloc.pools), pool(alloc.pool) {}
+	template <class V>
+	inline pool_allocator(const pool_allocator<V>& alloc)
+		: pools(alloc.pools), pool(&pools->get(sizeof(U))) {}
+	pool_allocator& operator =(const pool_allocator&) = default;
+	inline U *allocate(size_t n)
+	{
+		if (n != 1)
+			return (U*)::operator new(n * sizeof(U));
+		return (U*)pool->acquire();
+	}
+	inline void deallocate(U *ptr, size_t n)
+	{
+		if (n != 1)
+			::operator delete(ptr);
+		else
+			pool->release(ptr);
+	}
+	template <class V>
+	inline bool operator ==(const pool_allocator<V>& rhs) const
+	{
+		return pools == rhs.pools;
+	}
+	template <class V>
+	inline bool operator !=(const pool_allocator<V>& rhs) const
+	{
+		return pools != rhs.pools;
+	}
+};
+
+
+inline
+slab_pool::slab_pool(size_t block_size, size_t blocks_per_slab)
+{
+	const size_t align = alignof(max_align_t);
+	if (block_size < sizeof(void*))
+		block_size = sizeof(void*);
+	this->block_size = (block_size + align - 1) / align * align;
+	this->blocks_per_slab = blocks_per_slab ? blocks_per_slab : 1;
+	this->free_list = NULL;
+	this->slab_next = this->slab_end = NULL;
+}
+
+
+inline
+slab_pool::slab_pool(slab_pool&& pool)
+{
+	block_size = pool.block_size;
+	blocks_per_slab = pool.blocks_per_slab;
+	slabs.swap(pool.slabs);
+	free_list = pool.free_list;
+	slab_next = pool.slab_next;
+	slab_end = pool.slab_end;
+	pool.free_list = NULL;
+	pool.slab_next = pool.slab_end = NULL;
+}
+
+
+inline void
+slab_pool::grow(void)
+{
+	size_t slab_size = block_size * blocks_per_slab;
+	char *slab = (char*)malloc(slab_size);
+	if (!slab)
+		throw bad_alloc();
+	slabs.push_back(slab);
+	slab_next = slab;
+	slab_end = slab + slab_size;
+}
+
+
+inline
+slab_pool::~slab_pool(void)
+{
+	for (void *slab : slabs)
+		free(slab);
+}
+
+
+inline slab_pool&
+slab_pool_set::get(size_t block_size)
+{
+	for (pair<size_t, unique_ptr<slab_pool>>& pool : pools)
+		if (pool.first == block_size)
+			return *pool.second;
+	pools.emplace_back(block_size,
+			   unique_ptr<slab_pool>(new slab_pool(block_size)));
+	return *pools.back().second;
+}
+#endif /* SLAB_POOL */
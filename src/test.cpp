@@ -1,32 +1,599 @@
+#include <ctype.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <algorithm>
+#include <fstream>
 #include <iostream>
+#include <sstream>
+#include <string>
 #include <vector>
-#include "loader.hpp"
+#include "dedupe.hpp"
 #include "event_iterator.hpp"
+#include "generator.hpp"
+#include "output_writer.hpp"
+#include "shard_merge.hpp"
+
+// Resumed cursors are saved after this many candidates
+#define TEST_CHECKPOINT_AFTER 1000
+#define TEST_SHARDS 3
+// Too little for the exact filter to remember all of its candidates
+#define TEST_FILTER_MEMORY 20000
+#define TEST_FILTER_CANDIDATES 1000
+// Three parts of this size make a record too large for the output buffer
+#define TEST_OVERSIZED_PART 400000
+// Not a divisor of the number of generated candidates
+#define TEST_GENERATOR_BATCH 7
 
 
 using namespace std;
 
 
-static void event_iteration_cb(const vector<int>& outcomes, void *cb_data)
+struct candidate {
+	vector<int> outcomes;
+	double logprob;
+	inline bool operator ==(const candidate& rhs) const
+	{
+		return outcomes == rhs.outcomes && logprob == rhs.logprob;
+	}
+};
+
+
+static const int sample_space_sizes[] = {7, 5, 6, 4, 9};
+static int n_failed = 0;
+
+
+static void check(bool passed, const char *name)
 {
-	cout << "Got outcomes in event iteration:";
-	for (int idx : outcomes)
-		cout << " " << idx;
-	cout << "\n";
+	cout << (passed ? "PASS " : "FAIL ") << name << "\n";
+	if (!passed)
+		n_failed++;
 }
 
 
-/* TODO: Test loader.cpp for file reading errors */
-int main(int argc, char *argv[])
+/*
+ * Small event list with pseudo-random frequencies, so no two outcome lists
+ * are equally likely and the order of the enumeration is fully determined.
+ */
+static event_list *build_test_list(enum enumeration_mode mode,
+				   unsigned long long max_candidates,
+				   double min_logprob)
+{
+	int n_events = sizeof sample_space_sizes / sizeof *sample_space_sizes;
+	event_list *list = new event_list(n_events);
+	unsigned long long state = 88172645463325252ULL;
+
+	for (int i=0; i<n_events; i++) {
+		vector<int> identifiers;
+		vector<unsigned long long> freqs;
+		for (int j=0; j<sample_space_sizes[i]; j++) {
+			state ^= state << 13;
+			state ^= state >> 7;
+			state ^= state << 17;
+			identifiers.push_back(j);
+			freqs.push_back(1 + state % 1000003);
+		}
+		list->set_event_sample_space(i, identifiers, freqs);
+	}
+	list->set_enumeration_mode(mode);
+	list->set_limits(max_candidates, min_logprob);
+	return list;
+}
+
+
+static bool collect_cb(const vector<int>& outcomes, double logprob,
+		       void *cb_data)
+{
+	((vector<candidate>*)cb_data)->push_back((candidate){outcomes, logprob});
+	return true;
+}
+
+
+static vector<candidate> enumerate(event_list *list)
+{
+	vector<candidate> candidates;
+	list->iterate_sorted(collect_cb, &candidates);
+	return candidates;
+}
+
+
+/* Outcome identifiers joined by commas, the text of a test candidate */
+static string render(const vector<int>& outcomes)
+{
+	string text;
+	for (size_t i=0; i<outcomes.size(); i++)
+		text += (i ? "," : "") + to_string(outcomes[i]);
+	return text;
+}
+
+
+static bool write_cb(const vector<int>& outcomes, double logprob,
+		     void *cb_data)
+{
+	string text = render(outcomes);
+	const char *part = text.data();
+	size_t len = text.size();
+	return ((candidate_writer*)cb_data)->write_candidate(&part, &len, 1,
+							     logprob);
+}
+
+
+/* Writes the candidates of list with their log-probabilities to path */
+static bool write_candidates(event_list *list, const string& path)
 {
-	frequency_data_loader loader;
-	if (!loader.load_frequency_file("outfile")) {
-		cerr << "Failed to load file!\n";
-		return -1;
+	int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0)
+		return false;
+	{
+		candidate_writer writer(fd, DELIMIT_NEWLINE, true);
+		list->iterate_sorted(write_cb, &writer);
 	}
+	close(fd);
+	return true;
+}
+
+
+static string read_file(const string& path)
+{
+	ifstream in(path, ios::binary);
+	stringstream contents;
+	contents << in.rdbuf();
+	return contents.str();
+}
+
+
+/*
+ * The canonical enumeration reaches every outcome list from a single parent
+ * instead of deduplicating through a set, and has to visit the same lists in
+ * the same order.
+ */
+static void test_canonical_enumeration(void)
+{
+	event_list *deduplicated, *canonical;
+	vector<candidate> expected, got;
+	size_t lattice_size = 1;
+
+	for (int size : sample_space_sizes)
+		lattice_size *= size;
+	deduplicated = build_test_list(ENUMERATE_DEDUPLICATED, 0, -INFINITY);
+	canonical = build_test_list(ENUMERATE_CANONICAL, 0, -INFINITY);
+	expected = enumerate(deduplicated);
+	got = enumerate(canonical);
+	check(expected.size() == lattice_size,
+	      "deduplicated enumeration visits the whole lattice");
+	check(got == expected, "canonical enumeration matches deduplicated");
+	delete canonical;
+	delete deduplicated;
+
+	deduplicated = build_test_list(ENUMERATE_DEDUPLICATED, 500, -INFINITY);
+	canonical = build_test_list(ENUMERATE_CANONICAL, 500, -INFINITY);
+	check(enumerate(canonical) == enumerate(deduplicated),
+	      "canonical enumeration matches deduplicated with a limit");
+	delete canonical;
+	delete deduplicated;
+}
+
+
+/*
+ * Limits cut the unlimited enumeration short without changing it: a candidate
+ * limit keeps its first candidates, a log-probability limit the ones at or
+ * above it.
+ */
+static void test_limits(void)
+{
+	event_list *list = build_test_list(ENUMERATE_CANONICAL, 0, -INFINITY);
+	vector<candidate> unlimited = enumerate(list), expected;
+	struct enumeration_stats stats;
+	double min_logprob;
+
+	delete list;
+	for (size_t max_candidates : {1, 10, 100}) {
+		list = build_test_list(ENUMERATE_CANONICAL, max_candidates,
+				       -INFINITY);
+		expected.assign(unlimited.begin(),
+				unlimited.begin() + max_candidates);
+		check(enumerate(list) == expected,
+		      ("candidate limit of " + to_string(max_candidates) +
+		       " keeps the first candidates").c_str());
+		delete list;
+	}
+
+	list = build_test_list(ENUMERATE_CANONICAL, 10, -INFINITY);
+	{
+		event_cursor cursor(*list);
+		candidate c;
+		while (cursor.next(c.outcomes, c.logprob))
+			;
+		cursor.get_stats(stats);
+	}
+	check(stats.nodes_trimmed > 0, "candidate limit trims the frontier");
+	delete list;
+
+	min_logprob = unlimited[unlimited.size() / 3].logprob;
+	list = build_test_list(ENUMERATE_CANONICAL, 0, min_logprob);
+	expected.clear();
+	for (const candidate& c : unlimited)
+		if (c.logprob >= min_logprob)
+			expected.push_back(c);
+	check(!expected.empty() && expected.size() < unlimited.size() &&
+	      enumerate(list) == expected,
+	      "log-probability limit keeps the candidates at or above it");
+	delete list;
+}
+
+
+/*
+ * Banded enumeration visits the same lists as the sorted one, and never one
+ * after a list more than n_events band widths less likely than itself.
+ */
+static void test_banded(double band_width)
+{
+	event_list *list = build_test_list(ENUMERATE_CANONICAL, 0, -INFINITY);
+	vector<candidate> expected = enumerate(list), got;
+	double slack = list->n_events * band_width, least = INFINITY;
+	bool same = true, ordered = true;
+	char name[80];
+	auto by_outcomes = [](const candidate& a, const candidate& b) {
+		return a.outcomes < b.outcomes;
+	};
 
-	
+	list->iterate_banded(collect_cb, &got, band_width);
+	for (const candidate& c : got) {
+		if (c.logprob > least + slack)
+			ordered = false;
+		least = min(least, c.logprob);
+	}
+	sort(expected.begin(), expected.end(), by_outcomes);
+	sort(got.begin(), got.end(), by_outcomes);
+	same = got.size() == expected.size();
+	for (size_t i=0; same && i<got.size(); i++)
+		same = got[i].outcomes == expected[i].outcomes &&
+		       fabs(got[i].logprob - expected[i].logprob) < 1e-9;
+	snprintf(name, sizeof name, "banded enumeration with width %g visits "
+		 "the sorted lists", band_width);
+	check(same, name);
+	snprintf(name, sizeof name, "banded enumeration with width %g keeps "
+		 "within its bands", band_width);
+	check(ordered, name);
+	delete list;
+}
+
+
+/*
+ * The keyspace bounds hold around the exact counts of an enumeration: at
+ * least lower lists are likelier than the threshold and at most upper are at
+ * least as likely.
+ */
+static void test_count_likelier(int n_bins)
+{
+	event_list *list = build_test_list(ENUMERATE_CANONICAL, 0, -INFINITY);
+	vector<candidate> candidates = enumerate(list);
+	bool bounded = true;
+	char name[80];
+
+	for (size_t idx : {(size_t)0, (size_t)10, candidates.size() / 2,
+			   candidates.size() - 1}) {
+		double logprob = candidates[idx].logprob, lower, upper;
+		double likelier = 0, as_likely = 0;
+		for (const candidate& c : candidates) {
+			likelier += c.logprob > logprob;
+			as_likely += c.logprob >= logprob;
+		}
+		list->count_likelier(logprob, n_bins, lower, upper);
+		if (!(lower <= likelier && as_likely <= upper))
+			bounded = false;
+	}
+	snprintf(name, sizeof name, "keyspace bounds with %d bins hold around "
+		 "the exact counts", n_bins);
+	check(bounded, name);
+	delete list;
+}
+
+
+/* Inserts text as two parts split in the middle, like a rendered candidate */
+static bool filter_insert(candidate_filter& filter, const string& text)
+{
+	const char *parts[2] = {text.data(), text.data() + text.size() / 2};
+	size_t lens[2] = {text.size() / 2, text.size() - text.size() / 2};
+	return filter.insert(parts, lens, 2);
+}
+
+
+/*
+ * The exact filter drops every repeat until its memory runs out, and then
+ * still drops repeats of what it remembered while passing everything else.
+ */
+static void test_exact_filter(void)
+{
+	candidate_filter filter(DEDUPE_EXACT, TEST_FILTER_MEMORY);
+	const char *parts[2] = {"pass", "word"}, *other[2] = {"pas", "sword"};
+	size_t lens[2] = {4, 4}, other_lens[2] = {3, 5};
+	size_t n_remembered = 0;
+	bool fresh = true, prefix = true;
+
+	check(filter.insert(parts, lens, 2) &&
+	      !filter.insert(other, other_lens, 2),
+	      "exact filter drops a repeat split into other parts");
+	for (int i=0; i<TEST_FILTER_CANDIDATES; i++)
+		if (!filter_insert(filter, "candidate" + to_string(i)))
+			fresh = false;
+	// Only the candidates inserted before the filter filled up are kept
+	for (int i=0; i<TEST_FILTER_CANDIDATES; i++) {
+		bool passed = filter_insert(filter, "candidate" + to_string(i));
+		if (!passed && n_remembered < (size_t)i)
+			prefix = false;
+		n_remembered += !passed;
+	}
+	check(fresh, "exact filter passes new candidates");
+	check(prefix && n_remembered > 0 &&
+	      n_remembered < TEST_FILTER_CANDIDATES,
+	      "full exact filter drops only the candidates it remembers");
+	check(!filter.insert(parts, lens, 2),
+	      "full exact filter still drops remembered repeats");
+}
+
+
+/*
+ * The approximate filter never passes a repeat, and with room to spare drops
+ * no new candidate either.
+ */
+static void test_approximate_filter(void)
+{
+	candidate_filter filter(DEDUPE_APPROXIMATE);
+	bool fresh = true, repeats_dropped = true;
+
+	for (int i=0; i<TEST_FILTER_CANDIDATES; i++)
+		if (!filter_insert(filter, "candidate" + to_string(i)))
+			fresh = false;
+	for (int i=0; i<TEST_FILTER_CANDIDATES; i++)
+		if (filter_insert(filter, "candidate" + to_string(i)))
+			repeats_dropped = false;
+	check(fresh, "approximate filter passes new candidates");
+	check(repeats_dropped, "approximate filter drops every repeat");
+}
+
+
+/*
+ * Records come out byte for byte as documented, including one too large for
+ * the buffer that is written straight from its parts.
+ */
+static void test_writer(enum output_delimiter delimiter, bool print_logprob,
+			const char *name)
+{
+	string oversized[3] = {string(TEST_OVERSIZED_PART, 'a'),
+			       string(TEST_OVERSIZED_PART, 'b'),
+			       string(TEST_OVERSIZED_PART, 'c')};
+	vector<vector<string>> records = {{"pass", "word", "1"}, {"", "", ""},
+					  {oversized[0], oversized[1],
+					   oversized[2]}};
+	const char *columns[] = {"-1.5\t", "-2\t", "-3.25\t"};
+	double logprobs[] = {-1.5, -2.0, -3.25};
+	FILE *file = tmpfile();
+	string expected, got;
+	bool written = file != NULL;
+	char chunk[65536];
+	ssize_t len;
+
+	for (size_t i=0; i<records.size(); i++) {
+		string body = print_logprob ? columns[i] : "";
+		for (const string& part : records[i])
+			body += part;
+		if (delimiter == DELIMIT_LENGTH)
+			for (int j=0; j<4; j++)
+				expected += (char)(body.size() >> (8 * j));
+		expected += body;
+		if (delimiter != DELIMIT_LENGTH)
+			expected += delimiter == DELIMIT_NUL ? '\0' : '\n';
+	}
+
+	if (file) {
+		candidate_writer writer(fileno(file), delimiter, print_logprob);
+		for (size_t i=0; written && i<records.size(); i++) {
+			const char *parts[3];
+			size_t lens[3];
+			for (int j=0; j<3; j++) {
+				parts[j] = records[i][j].data();
+				lens[j] = records[i][j].size();
+			}
+			written = writer.write_candidate(parts, lens, 3,
+							 logprobs[i]);
+		}
+		written = written && writer.flush() &&
+			  writer.written() == expected.size();
+		lseek(fileno(file), 0, SEEK_SET);
+		while ((len = read(fileno(file), chunk, sizeof chunk)) > 0)
+			got.append(chunk, len);
+		fclose(file);
+	}
+	check(written && got == expected, name);
+}
+
+
+/*
+ * Small frequency file where every character may keep or swap its case, with
+ * a few prefixes and suffixes.
+ */
+static bool write_test_model(const string& path)
+{
+	ofstream out(path);
+	const char *sections[] = {":leading:", ":normal:"};
+	unsigned long long state = 88172645463325252ULL;
+
+	out << ":prefix:\nSTART 3\n>the\n20\n>my\n35\n>\n100\nEND\n";
+	out << ":suffix:\nSTART 3\n>1\n40\n>!\n25\n>\n100\nEND\n";
+	for (const char *section : sections) {
+		out << section << "\nSTART 256\n";
+		for (int c=0; c<256; c++) {
+			state ^= state << 13;
+			state ^= state >> 7;
+			state ^= state << 17;
+			if (isalpha(c))
+				out << "2 " << c << ":" << 100 + state % 1000
+				    << " " << (c ^ 0x20) << ":"
+				    << 1 + state % 97 << "\n";
+			else
+				out << "1 " << c << ":1\n";
+		}
+		out << "END\n";
+	}
+	return (bool)out;
+}
+
+
+/*
+ * Batches hold the same candidates in the same order as single steps, and an
+ * empty seed generates nothing.
+ */
+static void test_generator(void)
+{
+	char path[] = "/tmp/mutator-test-XXXXXX";
+	int fd = mkstemp(path);
+	frequency_data_loader model;
+	vector<pair<string, double>> expected, got;
+	generated_candidate candidates[TEST_GENERATOR_BATCH];
+	bool loaded;
+
+	if (fd >= 0)
+		close(fd);
+	loaded = fd >= 0 && write_test_model(path) &&
+		 model.load_frequency_file(path);
+	if (fd >= 0)
+		unlink(path);
+	check(loaded, "test model loads");
+	if (!loaded)
+		return;
+
+	{
+		generator single(model, "Pass"), batched(model, "Pass");
+		generated_candidate c;
+		size_t n;
+		while (single.next(c))
+			expected.push_back({string(c.text), c.logprob});
+		while ((n = batched.next_batch(candidates,
+					       TEST_GENERATOR_BATCH)) > 0)
+			for (size_t i=0; i<n; i++)
+				got.push_back({string(candidates[i].text),
+					       candidates[i].logprob});
+	}
+	check(expected.size() == 3 * 16 * 3 && got == expected,
+	      "generator batches match single steps");
+
+	{
+		generator empty(model, "");
+		generated_candidate c;
+		check(!empty.ok() && !empty.next(c) &&
+		      empty.next_batch(candidates, TEST_GENERATOR_BATCH) == 0,
+		      "generator rejects an empty seed");
+	}
+}
+
+
+/*
+ * A cursor restored from a checkpoint on a fresh copy of the list continues
+ * exactly where the saved one stood, limits included.
+ */
+static void test_checkpoint_resume(enum enumeration_mode mode,
+				   unsigned long long max_candidates,
+				   double min_logprob, const char *name)
+{
+	event_list *list = build_test_list(mode, max_candidates, min_logprob);
+	event_list *copy = build_test_list(mode, max_candidates, min_logprob);
+	vector<candidate> expected = enumerate(list), got;
+	stringstream checkpoint;
+	candidate c;
+	bool restored;
+
+	{
+		event_cursor cursor(*list);
+		while (got.size() < TEST_CHECKPOINT_AFTER &&
+		       cursor.next(c.outcomes, c.logprob))
+			got.push_back(c);
+		cursor.save(checkpoint);
+	}
+	{
+		event_cursor cursor(*copy);
+		restored = cursor.restore(checkpoint);
+		while (restored && cursor.next(c.outcomes, c.logprob))
+			got.push_back(c);
+	}
+	check(restored && expected.size() > TEST_CHECKPOINT_AFTER &&
+	      got == expected, name);
+	delete copy;
+	delete list;
+}
+
+
+/* Shards printed with their log-probabilities merge into the unsharded run */
+static void test_shard_merge(void)
+{
+	event_list *list = build_test_list(ENUMERATE_CANONICAL, 0, -INFINITY);
+	string dir = "/tmp/mutator-test-XXXXXX", expected, merged;
+	vector<string> paths;
+	bool written = mkdtemp(&dir[0]) != NULL;
+	int fd = -1;
+
+	written = written && write_candidates(list, dir + "/unsharded");
+	for (int i=0; written && i<TEST_SHARDS; i++) {
+		event_list *shard = list->partition(list->partition_event(),
+						    TEST_SHARDS, i);
+		paths.push_back(dir + "/shard" + to_string(i));
+		written = write_candidates(shard, paths.back());
+		delete shard;
+	}
+	if (written)
+		fd = open((dir + "/merged").c_str(),
+			  O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd >= 0) {
+		candidate_writer writer(fd, DELIMIT_NEWLINE, true);
+		written = merge_shards(paths, DELIMIT_NEWLINE, writer, 0) == 0;
+	}
+	if (fd >= 0)
+		close(fd);
+	expected = read_file(dir + "/unsharded");
+	merged = read_file(dir + "/merged");
+	check(written && fd >= 0 && !expected.empty() && merged == expected,
+	      "merged shards match the unsharded run");
+
+	paths.push_back(dir + "/unsharded");
+	paths.push_back(dir + "/merged");
+	for (const string& path : paths)
+		unlink(path.c_str());
+	rmdir(dir.c_str());
+	delete list;
+}
+
+
+/* TODO: Test loader.cpp for file reading errors */
+int main(int argc, char *argv[])
+{
+	test_canonical_enumeration();
+	test_limits();
+	test_banded(0.5);
+	test_banded(2.0);
+	test_count_likelier(16);
+	test_count_likelier(4096);
+	test_exact_filter();
+	test_approximate_filter();
+	test_writer(DELIMIT_NEWLINE, false, "writer terminates records by newlines");
+	test_writer(DELIMIT_NUL, false, "writer terminates records by NUL bytes");
+	test_writer(DELIMIT_LENGTH, false, "writer prefixes records by lengths");
+	test_writer(DELIMIT_NEWLINE, true,
+		    "writer prints log-probabilities before newline records");
+	test_writer(DELIMIT_LENGTH, true,
+		    "writer prints log-probabilities after record lengths");
+	test_generator();
+	test_checkpoint_resume(ENUMERATE_CANONICAL, 0, -INFINITY,
+			       "canonical cursor resumes from a checkpoint");
+	test_checkpoint_resume(ENUMERATE_DEDUPLICATED, 0, -INFINITY,
+			       "deduplicated cursor resumes from a checkpoint");
+	test_checkpoint_resume(ENUMERATE_CANONICAL, 3000, -INFINITY,
+			       "resumed cursor keeps the candidate limit");
+	test_checkpoint_resume(ENUMERATE_CANONICAL, 0, -12.0,
+			       "resumed cursor keeps the log-probability limit");
+	test_shard_merge();
 
-	cout << "Exiting with return value " << 0 << "\n";
-	return 0;
+	cout << (n_failed ? "FAILED " : "PASSED ") << n_failed << " failures\n";
+	return n_failed ? 1 : 0;
 }